@@ -2,7 +2,6 @@
 #include <csignal>
 #include <iostream>
 #include <mutex>
-#include <thread>
 
 #include <boost/foreach.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -13,9 +12,13 @@
 
 #include "dnp3/client.hpp"
 #include "dnp3/common.hpp"
+#include "dnp3/logger.hpp"
+#include "dnp3/manager.hpp"
 #include "dnp3/server.hpp"
 #include "msgbus/pusher.hpp"
+#include "msgbus/scheduler.hpp"
 #include "msgbus/subscriber.hpp"
+#include "msgbus/trace.hpp"
 
 namespace pt = boost::property_tree;
 
@@ -32,40 +35,43 @@ public:
     return std::make_shared<ChannelListener>(name, pusher);
   }
 
-  ChannelListener(std::string name, otsim::dnp3::Pusher pusher) : name(name), pusher(pusher), currentState(opendnp3::ChannelState::CLOSED) {
-    thread = std::thread(std::bind(&ChannelListener::Run, this));
+  ChannelListener(std::string name, otsim::dnp3::Pusher pusher) : name(name), pusher(pusher), logger(name), currentState(opendnp3::ChannelState::CLOSED) {
+    heartbeat = otsim::msgbus::SharedScheduler().Every(std::chrono::seconds(5), std::bind(&ChannelListener::Run, this));
   }
 
-  ~ChannelListener() {};
+  ~ChannelListener() {
+    Stop();
+  };
 
   void OnStateChange(opendnp3::ChannelState state) {
     auto lock = std::unique_lock<std::mutex>(mu);
     currentState = state;
 
+    logger.Info("setting connected status to {}", connected());
     publish();
   }
 
   void Run() {
-    while (true) {
-      {
-        auto lock = std::unique_lock<std::mutex>(mu);
-        publish();
-      }
+    auto lock = std::unique_lock<std::mutex>(mu);
 
-      std::this_thread::sleep_for(std::chrono::seconds(5));
-    }
+    logger.Debug("setting connected status to {}", connected());
+    publish();
+  }
+
+  void SetLogLevel(otsim::dnp3::LogLevel level) { logger.SetLevel(level); }
+
+  void Stop() {
+    otsim::msgbus::SharedScheduler().Cancel(heartbeat);
   }
 
 private:
+  bool connected() {
+    return currentState == opendnp3::ChannelState::OPEN;
+  }
+
   void publish() {
     std::string tag   = fmt::format("{}.connected", name);
-    bool        value = false;
-
-    if (currentState == opendnp3::ChannelState::OPEN) {
-      value = true;
-    }
-
-    std::cout << fmt::format("[{}] setting connected status to {}", name, value) << std::endl;
+    bool        value = connected();
 
     otsim::msgbus::Points points;
     points.push_back(otsim::msgbus::Point{tag, value ? 1.0 : 0.0});
@@ -78,11 +84,12 @@ private:
 
   std::string         name;
   otsim::dnp3::Pusher pusher;
+  otsim::dnp3::Logger logger;
 
   opendnp3::ChannelState currentState;
 
-  std::thread thread;
-  std::mutex  mu;
+  otsim::msgbus::Scheduler::TaskID heartbeat;
+  std::mutex mu;
 };
 
 int main(int argc, char** argv) {
@@ -91,17 +98,23 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  // Keep servers in scope so their threads don't terminate immediately.
+  // Keep servers in scope so their scheduled tasks keep running.
   std::vector<std::shared_ptr<otsim::dnp3::Server>> servers;
 
   // Keep clients in scope so their threads don't terminate immediately.
   std::vector<std::shared_ptr<otsim::dnp3::Client>> clients;
 
-  // Keep client channel listeners in scope so their threads don't terminate immediately.
+  // Keep client channel listeners in scope so their heartbeats keep running.
   std::vector<std::shared_ptr<ChannelListener>> listeners;
 
   // Keep subscribers in scope so their threads don't terminate immediately.
-  std::vector<std::shared_ptr<otsim::msgbus::Subscriber>> subscribers;
+  // Devices using the same endpoint share a single subscriber, so each message
+  // is only received and decoded once no matter how many devices handle it.
+  std::map<std::string, std::shared_ptr<otsim::msgbus::Subscriber>> subscribers;
+
+  // Devices using the same endpoint and settings share a single (thread-safe)
+  // pusher, and thus a single connection to the message bus.
+  std::map<std::string, std::shared_ptr<otsim::msgbus::Pusher>> pushers;
 
   pt::ptree tree;
   pt::read_xml(argv[1], tree);
@@ -114,13 +127,76 @@ int main(int argc, char** argv) {
 
     std::string pubEndpoint;
     std::string pullEndpoint;
+    std::string snapshotEndpoint;
+    std::string pullEncoding    = "json";
+    std::string pullQueuePolicy = "block";
+    std::size_t pullQueueSize   = 4096;
 
     try {
       auto msgbus = v.second.get_child("message-bus");
       pubEndpoint = msgbus.get<std::string>("pub-endpoint", "tcp://127.0.0.1:5678");
       pullEndpoint = msgbus.get<std::string>("pull-endpoint", "tcp://127.0.0.1:1234");
+      snapshotEndpoint = msgbus.get<std::string>("snapshot-endpoint", "");
+      pullEncoding = msgbus.get<std::string>("pull-endpoint.<xmlattr>.encoding", "json");
+      pullQueuePolicy = msgbus.get<std::string>("pull-endpoint.<xmlattr>.queue-policy", "block");
+      pullQueueSize = msgbus.get<std::size_t>("pull-endpoint.<xmlattr>.queue-size", 4096);
     } catch (pt::ptree_bad_path&) {}
 
+    // Tracing is process-wide, so the first device to configure a trace file
+    // wins.
+    if (auto path = v.second.get_optional<std::string>("message-bus.trace-file")) {
+      if (!otsim::msgbus::Tracing() && !otsim::msgbus::StartTracing(*path)) {
+        std::cerr << fmt::format("ERROR: unable to open trace file {}", *path) << std::endl;
+        return 1;
+      }
+    }
+
+    // Periodic tasks for all devices (applying points, restarts, metrics,
+    // heartbeats) run on a shared scheduler rather than dedicated threads.
+    if (auto threads = v.second.get_optional<std::size_t>("scheduler.threads")) {
+      otsim::msgbus::ConfigureScheduler(*threads);
+    }
+
+    // All DNP3 devices share a single DNP3 manager (and thus ASIO thread pool),
+    // so it must be configured before any devices are created.
+    {
+      auto mgr = v.second.get_child("dnp3-manager", pt::ptree());
+
+      otsim::dnp3::ManagerConfig config;
+
+      try {
+        config.threads  = mgr.get<std::uint32_t>("threads", 0);
+        config.affinity = otsim::dnp3::ParseCPUList(mgr.get<std::string>("cpu-affinity", ""));
+      } catch (const std::invalid_argument& e) {
+        std::cerr << fmt::format("ERROR: {} for DNP3 manager", e.what()) << std::endl;
+        return 1;
+      }
+
+      otsim::dnp3::ConfigureManager(config);
+
+      if (mgr.get<std::string>("metrics", "true") == "true") {
+        otsim::msgbus::PusherConfig pusherConfig;
+
+        try {
+          pusherConfig.encoding    = otsim::msgbus::ParseEncoding(pullEncoding);
+          pusherConfig.queuePolicy = otsim::msgbus::ParseQueuePolicy(pullQueuePolicy);
+          pusherConfig.queueSize   = pullQueueSize;
+        } catch (const std::invalid_argument& e) {
+          std::cerr << fmt::format("ERROR: {} for DNP3 manager", e.what()) << std::endl;
+          return 1;
+        }
+
+        auto key = fmt::format("{}|{}|{}|{}", pullEndpoint,
+          static_cast<int>(pusherConfig.encoding), static_cast<int>(pusherConfig.queuePolicy), pusherConfig.queueSize);
+
+        if (!pushers.count(key)) {
+          pushers[key] = otsim::msgbus::Pusher::Create(pullEndpoint, pusherConfig);
+        }
+
+        otsim::dnp3::StartManagerMetrics(pushers[key], "dnp3-manager");
+      }
+    }
+
     auto devices = v.second.equal_range("dnp3");
     for (auto iter = devices.first; iter != devices.second; ++iter) {
       auto device = iter->second;
@@ -143,18 +219,57 @@ int main(int argc, char** argv) {
         std::cerr << "ERROR: missing mode for DNP3 device" << std::endl;
       }
 
-      if (device.get_child_optional("pub-endpoint")) {
-        auto endpoint = device.get<std::string>("pub-endpoint");
-        sub = otsim::msgbus::Subscriber::Create(endpoint);
-      } else {
-        sub = otsim::msgbus::Subscriber::Create(pubEndpoint);
+      {
+        auto endpoint = device.get<std::string>("pub-endpoint", pubEndpoint);
+
+        if (!subscribers.count(endpoint)) {
+          subscribers[endpoint] = otsim::msgbus::Subscriber::Create(endpoint);
+
+          // Restarted modules get current point values from the broker's
+          // last-value cache instead of reporting zeros until they change.
+          auto snapshot = device.get<std::string>("snapshot-endpoint", snapshotEndpoint);
+
+          if (!snapshot.empty()) {
+            subscribers[endpoint]->SetSnapshotEndpoint(snapshot);
+          }
+        }
+
+        sub = subscribers[endpoint];
       }
 
-      if (device.get_child_optional("pull-endpoint")) {
-        auto endpoint = device.get<std::string>("pull-endpoint");
-        pusher = otsim::msgbus::Pusher::Create(endpoint);
-      } else {
-        pusher = otsim::msgbus::Pusher::Create(pullEndpoint);
+      otsim::msgbus::PusherConfig pusherConfig;
+
+      try {
+        pusherConfig.encoding    = otsim::msgbus::ParseEncoding(device.get<std::string>("pull-endpoint.<xmlattr>.encoding", pullEncoding));
+        pusherConfig.queuePolicy = otsim::msgbus::ParseQueuePolicy(device.get<std::string>("pull-endpoint.<xmlattr>.queue-policy", pullQueuePolicy));
+        pusherConfig.queueSize   = device.get<std::size_t>("pull-endpoint.<xmlattr>.queue-size", pullQueueSize);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << fmt::format("ERROR: {} for DNP3 device {}", e.what(), name) << std::endl;
+        return 1;
+      }
+
+      {
+        auto endpoint = device.get<std::string>("pull-endpoint", pullEndpoint);
+
+        auto key = fmt::format("{}|{}|{}|{}", endpoint,
+          static_cast<int>(pusherConfig.encoding), static_cast<int>(pusherConfig.queuePolicy), pusherConfig.queueSize);
+
+        if (!pushers.count(key)) {
+          pushers[key] = otsim::msgbus::Pusher::Create(endpoint, pusherConfig);
+        }
+
+        pusher = pushers[key];
+      }
+
+      // Device-wide log settings, which outstations and masters can override.
+      auto logLevel     = device.get<std::string>("log-level", "info");
+      auto logRateLimit = device.get<std::uint32_t>("log-rate-limit", 100);
+
+      try {
+        otsim::dnp3::ParseLogLevel(logLevel);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << fmt::format("ERROR: {} for DNP3 device {}", e.what(), name) << std::endl;
+        return 1;
       }
 
       if (mode.compare("server") == 0) {
@@ -207,6 +322,23 @@ int main(int argc, char** argv) {
             .remoteAddr = outstn.get<uint16_t>("remote-address", 1),
           };
 
+          config.updateMode     = outstn.get<std::string>("update-mode", "event");
+          config.coalesceWindow = std::chrono::milliseconds(outstn.get<std::uint64_t>("update-coalesce-window", 0));
+          config.logLevel       = outstn.get<std::string>("log-level", logLevel);
+          config.logRateLimit   = outstn.get<std::uint32_t>("log-rate-limit", logRateLimit);
+
+          try {
+            otsim::dnp3::ParseLogLevel(config.logLevel);
+          } catch (const std::invalid_argument& e) {
+            std::cerr << fmt::format("ERROR: {} for DNP3 outstation", e.what()) << std::endl;
+            return 1;
+          }
+
+          if (config.updateMode != "event" && config.updateMode != "poll") {
+            std::cerr << fmt::format("ERROR: invalid update mode {} provided for DNP3 outstation", config.updateMode) << std::endl;
+            return 1;
+          }
+
           otsim::dnp3::OutstationRestartConfig restart = { outstn.get<uint16_t>("warm-restart-delay", 30) };
 
           auto outstation = server->AddOutstation(config, restart, pusher);
@@ -401,6 +533,8 @@ int main(int argc, char** argv) {
         auto client   = otsim::dnp3::Client::Create();
         auto listener = ChannelListener::Create(name, pusher);
 
+        listener->SetLogLevel(otsim::dnp3::ParseLogLevel(logLevel));
+
         if (device.get_child_optional("endpoint")) {
           auto endpoint = device.get<std::string>("endpoint");
 
@@ -443,6 +577,20 @@ int main(int argc, char** argv) {
           std::uint64_t scanRate = mstr.get<std::uint64_t>("scan-rate", 30);
 
           auto master = client->AddMaster(id, local, remote, timeout, pusher);
+          master->SetMaxBatchSize(mstr.get<std::size_t>("max-batch-size", 0));
+
+          master->SetReportByException(
+            mstr.get<std::string>("report-by-exception", "false") == "true",
+            std::chrono::seconds(mstr.get<std::uint64_t>("report-by-exception.<xmlattr>.max-silence", 0))
+          );
+          master->SetLogRateLimit(mstr.get<std::uint32_t>("log-rate-limit", logRateLimit));
+
+          try {
+            master->SetLogLevel(otsim::dnp3::ParseLogLevel(mstr.get<std::string>("log-level", logLevel)));
+          } catch (const std::invalid_argument& e) {
+            std::cerr << fmt::format("ERROR: {} for DNP3 master", e.what()) << std::endl;
+            return 1;
+          }
           sub->AddHandler(std::bind(&otsim::dnp3::Master::HandleMsgBusUpdate, master, std::placeholders::_1));
  
           auto inputs = mstr.equal_range("input");
@@ -468,6 +616,7 @@ int main(int argc, char** argv) {
               auto tag  = point.get<std::string>("tag");
 
               master->AddAnalogTag(addr, tag);
+              master->SetDeadband(tag, point.get<double>("deadband", 0.0));
             } else {
               std::cerr << "ERROR: invalid type " << typ << " provided for DNP3 input" << std::endl;
               continue;
@@ -498,6 +647,7 @@ int main(int argc, char** argv) {
               auto sbo  = point.get<std::string>("sbo", "false") == "true";
 
               master->AddAnalogTag(addr, tag, sbo);
+              master->SetDeadband(tag, point.get<double>("deadband", 0.0));
             } else {
               std::cerr << "ERROR: invalid type " << typ << " provided for DNP3 output" << std::endl;
               continue;
@@ -556,12 +706,15 @@ int main(int argc, char** argv) {
         std::cerr << "ERROR: invalid mode provided for DNP3 config" << std::endl;
         return 1;
       }
-
-      sub->Start("RUNTIME");
-      subscribers.push_back(sub);
     }
   }
 
+  // Subscribers are shared by devices, so don't start them until all handlers
+  // have been added.
+  for (auto &kv : subscribers) {
+    kv.second->Start("RUNTIME");
+  }
+
   std::signal(SIGINT, signalHandler);
 
   std::unique_lock lk(m);
@@ -569,8 +722,8 @@ int main(int argc, char** argv) {
 
   // This *should* cause any blocking subscribers to immediately return so
   // threads can exit.
-  for (auto &sub : subscribers) {
-    sub->Stop();
+  for (auto &kv : subscribers) {
+    kv.second->Stop();
   }
 
   for (auto &client : clients) {
@@ -581,5 +734,13 @@ int main(int argc, char** argv) {
     server->Stop();
   }
 
+  for (auto &listener : listeners) {
+    listener->Stop();
+  }
+
+  otsim::dnp3::ShutdownManager();
+  otsim::dnp3::StopManagerMetrics();
+  otsim::msgbus::StopTracing();
+
   return 0;
 }
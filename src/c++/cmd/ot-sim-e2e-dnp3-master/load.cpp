@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "opendnp3/ConsoleLogger.h"
+#include "opendnp3/DNP3Manager.h"
+#include "opendnp3/master/DefaultMasterApplication.h"
+#include "opendnp3/master/ITaskCallback.h"
+#include "opendnp3/master/TaskConfig.h"
+
+#include "handler.hpp"
+#include "load.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Target {
+  std::string   host;
+  std::uint16_t port;
+  std::uint16_t address;
+};
+
+struct LoadConfig {
+  std::vector<Target> targets;
+
+  int masters = 1;
+
+  // Per master, per second. Zero disables.
+  double scanRate    = 1.0;
+  double commandRate = 0.0;
+
+  std::uint8_t classes = opendnp3::ClassField::CLASS_0 | opendnp3::ClassField::CLASS_1 | opendnp3::ClassField::CLASS_2 | opendnp3::ClassField::CLASS_3;
+
+  // Commands are sent to random indexes below these.
+  int binaryOutputs = 1;
+  int analogOutputs = 0;
+
+  double analogMin = 0.0;
+  double analogMax = 100.0;
+
+  bool directOperate = false;
+
+  int duration = 60;
+  int interval = 10;
+  int warmup   = 10;
+};
+
+// Latencies and failures of one kind of request made by every master.
+// Interval stats are reset every time they're reported.
+class Stats {
+public:
+  void Success(Clock::duration elapsed) {
+    auto ms = std::chrono::duration<double, std::milli>(elapsed).count();
+
+    std::scoped_lock<std::mutex> guard(mu);
+
+    interval.push_back(ms);
+    total.push_back(ms);
+  }
+
+  void Failure(const std::string& reason) {
+    std::scoped_lock<std::mutex> guard(mu);
+
+    intervalFailures[reason]++;
+    totalFailures[reason]++;
+  }
+
+  // Counts requests not made because the previous one hadn't completed yet,
+  // meaning the outstation (or the master) can't keep up with the rate.
+  void Skipped() {
+    std::scoped_lock<std::mutex> guard(mu);
+
+    intervalSkipped++;
+    totalSkipped++;
+  }
+
+  std::string Interval() {
+    std::scoped_lock<std::mutex> guard(mu);
+
+    auto summary = summarize(interval, intervalFailures, intervalSkipped);
+
+    interval.clear();
+    intervalFailures.clear();
+    intervalSkipped = 0;
+
+    return summary;
+  }
+
+  std::string Total() {
+    std::scoped_lock<std::mutex> guard(mu);
+    return summarize(total, totalFailures, totalSkipped);
+  }
+
+  std::uint64_t Successes() {
+    std::scoped_lock<std::mutex> guard(mu);
+    return total.size();
+  }
+
+private:
+  static std::string summarize(std::vector<double>& samples, const std::map<std::string, std::uint64_t>& failures, std::uint64_t skipped) {
+    std::stringstream out;
+    out << std::fixed << std::setprecision(1);
+
+    out << samples.size() << " ok";
+
+    if (!samples.empty()) {
+      std::sort(samples.begin(), samples.end());
+
+      auto at = [&](double q) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))];
+      };
+
+      out << " (ms p50 " << at(0.5) << ", p90 " << at(0.9) << ", p99 " << at(0.99) << ", max " << samples.back() << ")";
+    }
+
+    std::uint64_t failed = 0;
+
+    for (auto& [_, count] : failures) {
+      failed += count;
+    }
+
+    out << ", " << failed << " failed";
+
+    if (failed) {
+      out << " (";
+
+      for (auto it = failures.begin(); it != failures.end(); ++it) {
+        out << (it == failures.begin() ? "" : ", ") << it->first << ": " << it->second;
+      }
+
+      out << ")";
+    }
+
+    out << ", " << skipped << " skipped";
+
+    return out.str();
+  }
+
+  std::mutex mu;
+
+  std::vector<double> interval;
+  std::vector<double> total;
+
+  std::map<std::string, std::uint64_t> intervalFailures;
+  std::map<std::string, std::uint64_t> totalFailures;
+
+  std::uint64_t intervalSkipped = 0;
+  std::uint64_t totalSkipped    = 0;
+};
+
+class ChannelListener : public opendnp3::IChannelListener {
+public:
+  ChannelListener(std::atomic<int>& open) : open(open) {}
+
+  void OnStateChange(opendnp3::ChannelState state) override {
+    bool now = state == opendnp3::ChannelState::OPEN;
+
+    if (now != isOpen) {
+      open += now ? 1 : -1;
+      isOpen = now;
+    }
+  }
+
+private:
+  std::atomic<int>& open;
+  bool isOpen = false;
+};
+
+// A single master, with its own channel to its target outstation. Only ever
+// has one scan and one command outstanding at a time.
+class LoadMaster : public opendnp3::ITaskCallback, public std::enable_shared_from_this<LoadMaster> {
+public:
+  LoadMaster(const LoadConfig& config, Stats& scans, Stats& commands, std::shared_ptr<opendnp3::IMaster> master)
+    : config(config), scans(scans), commands(commands), master(master), handler(std::make_shared<TestHandler>()), rand(std::random_device{}()) {}
+
+  void Scan() {
+    if (scanPending.exchange(true)) {
+      scans.Skipped();
+      return;
+    }
+
+    // Only read once the scan completes, which happens-after it's started.
+    scanStart = Clock::now();
+    master->ScanClasses(opendnp3::ClassField(config.classes), handler, opendnp3::TaskConfig::With(shared_from_this()));
+  }
+
+  void Command() {
+    if (commandPending.exchange(true)) {
+      commands.Skipped();
+      return;
+    }
+
+    bool binary = config.analogOutputs == 0 || (config.binaryOutputs > 0 && std::uniform_int_distribution<int>(0, 1)(rand));
+
+    if (binary) {
+      std::uint16_t index = std::uniform_int_distribution<int>(0, config.binaryOutputs - 1)(rand);
+      auto code = std::uniform_int_distribution<int>(0, 1)(rand) ? opendnp3::OperationType::LATCH_ON : opendnp3::OperationType::LATCH_OFF;
+
+      operate(opendnp3::CommandSet({ WithIndex(opendnp3::ControlRelayOutputBlock(code), index) }));
+    } else {
+      std::uint16_t index = std::uniform_int_distribution<int>(0, config.analogOutputs - 1)(rand);
+      double value = std::uniform_real_distribution<double>(config.analogMin, config.analogMax)(rand);
+
+      operate(opendnp3::CommandSet({ WithIndex(opendnp3::AnalogOutputDouble64(value), index) }));
+    }
+  }
+
+  // BEGIN ITaskCallback Implementation
+  void OnStart() override {}
+
+  void OnComplete(opendnp3::TaskCompletion result) override {
+    if (result == opendnp3::TaskCompletion::SUCCESS) {
+      scans.Success(Clock::now() - scanStart);
+    } else {
+      scans.Failure(opendnp3::TaskCompletionSpec::to_human_string(result));
+    }
+
+    scanPending = false;
+  }
+
+  void OnDestroyed() override {}
+  // END ITaskCallback Implementation
+
+private:
+  void operate(opendnp3::CommandSet&& set) {
+    auto start = Clock::now();
+
+    auto callback = [this, start](const opendnp3::ICommandTaskResult& result) {
+      std::string failure;
+
+      if (result.summary != opendnp3::TaskCompletion::SUCCESS) {
+        failure = opendnp3::TaskCompletionSpec::to_human_string(result.summary);
+      }
+
+      result.ForeachItem([&](const opendnp3::CommandPointResult& point) {
+        if (failure.empty() && point.state != opendnp3::CommandPointState::SUCCESS) {
+          failure = std::string(opendnp3::CommandPointStateSpec::to_human_string(point.state)) + " " + opendnp3::CommandStatusSpec::to_human_string(point.status);
+        }
+      });
+
+      if (failure.empty()) {
+        commands.Success(Clock::now() - start);
+      } else {
+        commands.Failure(failure);
+      }
+
+      commandPending = false;
+    };
+
+    if (config.directOperate) {
+      master->DirectOperate(std::move(set), callback);
+    } else {
+      master->SelectAndOperate(std::move(set), callback);
+    }
+  }
+
+  const LoadConfig& config;
+
+  Stats& scans;
+  Stats& commands;
+
+  std::shared_ptr<opendnp3::IMaster> master;
+  std::shared_ptr<TestHandler> handler;
+
+  std::atomic<bool> scanPending {false};
+  std::atomic<bool> commandPending {false};
+
+  Clock::time_point scanStart;
+
+  // Only used by the thread driving the load.
+  std::mt19937 rand;
+};
+
+static bool parseTarget(const std::string& spec, Target& target) {
+  // HOST:PORT[/ADDRESS]
+  auto colon = spec.rfind(':');
+
+  if (colon == std::string::npos) {
+    return false;
+  }
+
+  auto slash = spec.find('/', colon);
+
+  target.host    = spec.substr(0, colon);
+  target.port    = std::stoi(spec.substr(colon + 1, slash - colon - 1));
+  target.address = slash == std::string::npos ? 1024 : std::stoi(spec.substr(slash + 1));
+
+  return true;
+}
+
+static std::uint8_t parseClasses(const std::string& spec) {
+  std::uint8_t classes = 0;
+
+  for (auto c : spec) {
+    switch (c) {
+      case '0': classes |= opendnp3::ClassField::CLASS_0; break;
+      case '1': classes |= opendnp3::ClassField::CLASS_1; break;
+      case '2': classes |= opendnp3::ClassField::CLASS_2; break;
+      case '3': classes |= opendnp3::ClassField::CLASS_3; break;
+      default: throw std::invalid_argument("invalid class " + std::string(1, c));
+    }
+  }
+
+  return classes;
+}
+
+static void usage() {
+  std::cerr << "usage: ot-sim-e2e-dnp3-master load [options] HOST:PORT[/ADDRESS] ..." << std::endl << std::endl;
+  std::cerr << "Runs masters against the given outstations (link address 1024 by default), each" << std::endl;
+  std::cerr << "on its own connection, reporting scan and command latencies and failures." << std::endl;
+  std::cerr << "Masters are spread across the outstations given, round robin." << std::endl << std::endl;
+  std::cerr << "  -m COUNT      number of masters (default 1)" << std::endl;
+  std::cerr << "  -s RATE       class scans per second, per master (default 1)" << std::endl;
+  std::cerr << "  -k CLASSES    classes to scan (default 0123)" << std::endl;
+  std::cerr << "  -c RATE       commands per second, per master (default 0)" << std::endl;
+  std::cerr << "  -b COUNT      binary outputs to send random CROBs to (default 1)" << std::endl;
+  std::cerr << "  -a COUNT      analog outputs to send random values to (default 0)" << std::endl;
+  std::cerr << "  -r MIN:MAX    range of analog output values (default 0:100)" << std::endl;
+  std::cerr << "  -o            direct operate instead of select before operate" << std::endl;
+  std::cerr << "  -d SECONDS    how long to run for (default 60)" << std::endl;
+  std::cerr << "  -i SECONDS    how often to report interval stats (default 10)" << std::endl;
+  std::cerr << "  -w SECONDS    how long to wait for every master to connect (default 10)" << std::endl;
+}
+
+int RunLoad(int argc, char** argv) {
+  LoadConfig config;
+  int opt;
+
+  try {
+    while ((opt = getopt(argc, argv, "m:s:k:c:b:a:r:od:i:w:h")) != -1) {
+      switch (opt) {
+        case 'm': config.masters       = std::stoi(optarg); break;
+        case 's': config.scanRate      = std::stod(optarg); break;
+        case 'k': config.classes       = parseClasses(optarg); break;
+        case 'c': config.commandRate   = std::stod(optarg); break;
+        case 'b': config.binaryOutputs = std::stoi(optarg); break;
+        case 'a': config.analogOutputs = std::stoi(optarg); break;
+        case 'o': config.directOperate = true; break;
+        case 'd': config.duration      = std::stoi(optarg); break;
+        case 'i': config.interval      = std::stoi(optarg); break;
+        case 'w': config.warmup        = std::stoi(optarg); break;
+        case 'r': {
+          std::string range(optarg);
+          auto colon = range.find(':');
+
+          config.analogMin = std::stod(range.substr(0, colon));
+          config.analogMax = std::stod(range.substr(colon + 1));
+
+          break;
+        }
+        default:
+          usage();
+          return opt == 'h' ? 0 : 1;
+      }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+      Target target;
+
+      if (!parseTarget(argv[i], target)) {
+        throw std::invalid_argument("invalid outstation " + std::string(argv[i]));
+      }
+
+      config.targets.push_back(target);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "invalid arguments: " << e.what() << std::endl;
+    return 1;
+  }
+
+  if (config.targets.empty()) {
+    config.targets.push_back(Target{"127.0.0.1", 20000, 1024});
+  }
+
+  if (config.commandRate > 0 && config.binaryOutputs <= 0 && config.analogOutputs <= 0) {
+    std::cerr << "commands need at least one binary or analog output" << std::endl;
+    return 1;
+  }
+
+  std::shared_ptr<opendnp3::DNP3Manager> manager(new opendnp3::DNP3Manager(std::thread::hardware_concurrency(), opendnp3::ConsoleLogger::Create()));
+
+  Stats scans, commands;
+  std::atomic<int> open {0};
+
+  std::vector<std::shared_ptr<LoadMaster>> masters;
+
+  for (int i = 0; i < config.masters; ++i) {
+    auto& target = config.targets[i % config.targets.size()];
+    auto  id     = "load-master-" + std::to_string(i);
+
+    // Logging would mostly measure the console, so keep it to a minimum.
+    auto channel = manager->AddTCPClient(
+      id,
+      opendnp3::levels::NOTHING,
+      opendnp3::ChannelRetry::Default(),
+      std::vector<opendnp3::IPEndpoint>{opendnp3::IPEndpoint(target.host, target.port)},
+      "0.0.0.0",
+      std::make_shared<ChannelListener>(open)
+    );
+
+    opendnp3::MasterStackConfig stack;
+
+    stack.master.disableUnsolOnStartup       = true;
+    stack.master.startupIntegrityClassMask   = opendnp3::ClassField(opendnp3::ClassField::None());
+    stack.master.unsolClassMask              = opendnp3::ClassField(opendnp3::ClassField::None());
+    stack.master.integrityOnEventOverflowIIN = false;
+
+    stack.link.LocalAddr  = 1;
+    stack.link.RemoteAddr = target.address;
+
+    auto handler = std::make_shared<TestHandler>();
+    auto master  = channel->AddMaster(id, handler, opendnp3::DefaultMasterApplication::Create(), stack);
+
+    auto load = std::make_shared<LoadMaster>(config, scans, commands, master);
+
+    masters.push_back(load);
+    master->Enable();
+  }
+
+  std::cout << "waiting for " << config.masters << " masters to connect" << std::endl;
+
+  auto deadline = Clock::now() + std::chrono::seconds(config.warmup);
+
+  while (open < config.masters && Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  std::cout << open << " of " << config.masters << " masters connected, running for " << config.duration << "s" << std::endl;
+
+  // Every master scans (and commands) at the same rate, but they're started at
+  // random offsets within the first period so they aren't all in lockstep.
+  auto start = Clock::now();
+  auto end   = start + std::chrono::seconds(config.duration);
+
+  auto period = [](double rate) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(rate > 0 ? 1.0 / rate : 0));
+  };
+
+  auto scanPeriod    = period(config.scanRate);
+  auto commandPeriod = period(config.commandRate);
+
+  std::mt19937 rand(std::random_device{}());
+  std::uniform_real_distribution<double> phase(0.0, 1.0);
+
+  std::vector<Clock::time_point> nextScan, nextCommand;
+
+  for (int i = 0; i < config.masters; ++i) {
+    nextScan.push_back(start + std::chrono::duration_cast<Clock::duration>(scanPeriod * phase(rand)));
+    nextCommand.push_back(start + std::chrono::duration_cast<Clock::duration>(commandPeriod * phase(rand)));
+  }
+
+  auto nextReport = start + std::chrono::seconds(config.interval);
+
+  while (true) {
+    auto now = Clock::now();
+
+    if (now >= end) {
+      break;
+    }
+
+    // Wake up at least every 100ms regardless.
+    auto wake = now + std::chrono::milliseconds(100);
+
+    for (int i = 0; i < config.masters; ++i) {
+      if (config.scanRate > 0) {
+        if (now >= nextScan[i]) {
+          masters[i]->Scan();
+          nextScan[i] += scanPeriod;
+        }
+
+        wake = std::min(wake, nextScan[i]);
+      }
+
+      if (config.commandRate > 0) {
+        if (now >= nextCommand[i]) {
+          masters[i]->Command();
+          nextCommand[i] += commandPeriod;
+        }
+
+        wake = std::min(wake, nextCommand[i]);
+      }
+    }
+
+    if (config.interval > 0 && now >= nextReport) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
+
+      std::cout << "[" << std::setw(5) << elapsed << "s] " << open << "/" << config.masters << " connected" << std::endl;
+      std::cout << "  scans:    " << scans.Interval() << std::endl;
+      std::cout << "  commands: " << commands.Interval() << std::endl;
+
+      nextReport += std::chrono::seconds(config.interval);
+    }
+
+    std::this_thread::sleep_until(wake);
+  }
+
+  // Give outstanding requests a chance to finish before reporting.
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  std::cout << "totals over " << config.duration << "s" << std::endl;
+  std::cout << "  scans:    " << scans.Total() << std::endl;
+  std::cout << "  commands: " << commands.Total() << std::endl;
+
+  manager->Shutdown();
+
+  return config.scanRate > 0 && scans.Successes() == 0 ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#ifndef OTSIM_E2E_DNP3_MASTER_LOAD_HPP
+#define OTSIM_E2E_DNP3_MASTER_LOAD_HPP
+
+// Runs the load test, started with `ot-sim-e2e-dnp3-master load ...`. The
+// arguments start with "load". Returns the process exit code.
+int RunLoad(int argc, char** argv);
+
+#endif // OTSIM_E2E_DNP3_MASTER_LOAD_HPP
@@ -7,8 +7,13 @@
 #include "opendnp3/master/DefaultMasterApplication.h"
 
 #include "handler.hpp"
+#include "load.hpp"
 
 int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "load") {
+    return RunLoad(argc - 1, argv + 1);
+  }
+
   std::shared_ptr<opendnp3::DNP3Manager> manager(new opendnp3::DNP3Manager(std::thread::hardware_concurrency(), opendnp3::ConsoleLogger::Create()));
   std::shared_ptr<TestHandler> handler(new TestHandler());
 
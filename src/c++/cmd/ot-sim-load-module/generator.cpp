@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "fmt/format.h"
+
+#include "generator.hpp"
+
+namespace otsim {
+namespace load {
+
+Generator::Generator(const GeneratorConfig& config, std::shared_ptr<msgbus::Pusher> pusher) :
+  config(config), pusher(pusher), rand(std::random_device{}()) {
+  metrics = msgbus::MetricsPusher::Create();
+
+  pointCount    = metrics->NewMetric("Counter", "load_point_count",      "number of tag updates published");
+  envelopeCount = metrics->NewMetric("Counter", "load_envelope_count",   "number of status messages published");
+  lateCount     = metrics->NewMetric("Counter", "load_late_round_count", "number of update rounds started late");
+  targetRate    = metrics->NewMetric("Gauge",   "load_target_rate",      "target tag updates per second, including bursts");
+
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+  for (std::size_t i = 0; i < config.tags.size(); ++i) {
+    auto& dist = config.distribution;
+
+    values.push_back(config.tags[i].binary ? 0.0 : dist.min + (dist.max - dist.min) * unit(rand));
+    phases.push_back(2 * M_PI * unit(rand));
+  }
+}
+
+Generator::~Generator() {
+  Stop();
+}
+
+void Generator::Start() {
+  {
+    std::unique_lock<std::mutex> lock(mu);
+    running = true;
+  }
+
+  metrics->Start(pusher, config.name);
+  thread = std::thread(&Generator::run, this);
+}
+
+void Generator::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(mu);
+    running = false;
+  }
+
+  cv.notify_all();
+
+  if (thread.joinable()) {
+    thread.join();
+  }
+
+  metrics->Stop();
+}
+
+bool Generator::Running() {
+  std::unique_lock<std::mutex> lock(mu);
+  return running;
+}
+
+void Generator::run() {
+  auto start = Clock::now();
+  auto due   = start;
+
+  lastReport = start;
+
+  while (true) {
+    auto now = Clock::now();
+
+    if (config.duration.count() && now - start >= config.duration) {
+      break;
+    }
+
+    if (config.report.count() && now - lastReport >= config.report) {
+      report(now);
+    }
+
+    if (now < due) {
+      std::unique_lock<std::mutex> lock(mu);
+
+      // Wake up for reports even when publishing slowly.
+      auto wake = config.report.count() ? std::min(due, lastReport + config.report) : due;
+
+      if (cv.wait_until(lock, wake, [this]() { return !running; })) {
+        break;
+      }
+
+      continue;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    publish(elapsed);
+
+    double rate = config.rate * multiplier(elapsed);
+    targetRate.Set(rate * config.tags.size());
+
+    due += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+
+    // If a whole round behind, the next round is late. Don't try to catch up,
+    // since that would just publish back to back until caught up, which isn't
+    // the profile asked for.
+    if (due < Clock::now()) {
+      ++late;
+      lateCount.Incr();
+
+      due = Clock::now();
+    }
+  }
+
+  report(Clock::now());
+
+  std::unique_lock<std::mutex> lock(mu);
+  running = false;
+}
+
+void Generator::publish(double elapsed) {
+  msgbus::Points batch;
+  batch.reserve(std::min(config.points, config.tags.size()));
+
+  auto ts = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count());
+
+  auto flush = [&]() {
+    auto env = msgbus::NewEnvelope(config.name, msgbus::Status{.measurements = batch});
+
+    if (pusher->Push(config.topic, env)) {
+      ++envelopes;
+      envelopeCount.Incr();
+    } else {
+      ++dropped;
+    }
+
+    batch.clear();
+  };
+
+  for (std::size_t i = 0; i < config.tags.size(); ++i) {
+    batch.push_back(msgbus::Point{config.tags[i].name, next(i, elapsed), ts});
+
+    if (batch.size() == config.points) {
+      flush();
+    }
+  }
+
+  if (!batch.empty()) {
+    flush();
+  }
+
+  points += config.tags.size();
+  pointCount.Incr(config.tags.size());
+}
+
+void Generator::report(Clock::time_point now) {
+  double seconds = std::chrono::duration<double>(now - lastReport).count();
+
+  if (seconds <= 0) {
+    return;
+  }
+
+  double target = config.rate * config.tags.size();
+  std::string bursts;
+
+  if (config.burst.period > 0) {
+    bursts = fmt::format(", {:.0f} in bursts", target * config.burst.multiplier);
+  }
+
+  std::cout << fmt::format("[LOAD] {}: {:.0f} updates/sec ({:.0f} target{}), {:.0f} envelopes/sec, {} late rounds, {} dropped envelopes",
+    config.name, (points - reportedPoints) / seconds, target, bursts, (envelopes - reportedEnvelopes) / seconds,
+    late - reportedLate, dropped - reportedDropped) << std::endl;
+
+  reportedPoints    = points;
+  reportedEnvelopes = envelopes;
+  reportedLate      = late;
+  reportedDropped   = dropped;
+
+  lastReport = now;
+}
+
+double Generator::next(std::size_t i, double elapsed) {
+  auto& dist = config.distribution;
+  auto& val  = values[i];
+
+  if (config.tags[i].binary) {
+    if (std::bernoulli_distribution(dist.flip)(rand)) {
+      val = val == 0.0 ? 1.0 : 0.0;
+    }
+
+    return val;
+  }
+
+  if (dist.type == "normal") {
+    val = std::normal_distribution<double>(dist.mean, dist.stddev)(rand);
+  } else if (dist.type == "random-walk") {
+    val += std::uniform_real_distribution<double>(-dist.step, dist.step)(rand);
+    val  = std::clamp(val, dist.min, dist.max);
+  } else if (dist.type == "sine") {
+    double mid = (dist.min + dist.max) / 2;
+    val = mid + (dist.max - mid) * std::sin(2 * M_PI * elapsed / dist.period + phases[i]);
+  } else {
+    val = std::uniform_real_distribution<double>(dist.min, dist.max)(rand);
+  }
+
+  return val;
+}
+
+double Generator::multiplier(double elapsed) const {
+  auto& burst = config.burst;
+
+  if (burst.period <= 0) {
+    return 1.0;
+  }
+
+  return std::fmod(elapsed, burst.period) < burst.duration ? burst.multiplier : 1.0;
+}
+
+} // namespace load
+} // namespace otsim
@@ -0,0 +1,145 @@
+#ifndef OTSIM_LOAD_GENERATOR_HPP
+#define OTSIM_LOAD_GENERATOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "msgbus/metrics.hpp"
+#include "msgbus/pusher.hpp"
+
+namespace otsim {
+namespace load {
+
+// How new values are generated for analog tags. Binary tags ignore this and
+// flip with the configured probability instead.
+struct Distribution {
+  // uniform:     random between min and max
+  // normal:      normally distributed around mean
+  // random-walk: previous value plus a random step of up to +/- step, kept
+  //              between min and max
+  // sine:        sine wave between min and max, with the given period (each
+  //              tag starts at a different phase)
+  std::string type = "uniform";
+
+  double min    = 0.0;
+  double max    = 100.0;
+  double mean   = 50.0;
+  double stddev = 10.0;
+  double step   = 1.0;
+  double period = 60.0;
+
+  // Binary tags only.
+  double flip = 0.5;
+};
+
+// Every period seconds, the rate is multiplied by multiplier for duration
+// seconds. Disabled if period is zero.
+struct Burst {
+  double period     = 0.0;
+  double duration   = 0.0;
+  double multiplier = 1.0;
+};
+
+struct Tag {
+  std::string name;
+  bool binary = false;
+};
+
+struct GeneratorConfig {
+  std::string name  = "load";
+  std::string topic = "RUNTIME";
+
+  std::vector<Tag> tags;
+
+  // Updates per second of every tag, and the most points to send in a single
+  // Status envelope.
+  double      rate   = 1.0;
+  std::size_t points = 100;
+
+  Distribution distribution;
+  Burst        burst;
+
+  // Zero runs until stopped.
+  std::chrono::seconds duration {0};
+  std::chrono::seconds report   {5};
+};
+
+// Generator publishes new values for every configured tag rate times a
+// second (more during bursts) from a dedicated thread, so the rate isn't
+// limited by the resolution of the shared scheduler. Each round of updates
+// is split into Status envelopes of up to the configured number of points.
+//
+// Every report interval it logs the rates actually achieved alongside the
+// target, along with how many rounds started late (meaning the generator
+// couldn't keep up) and how many envelopes the pusher dropped. The same
+// numbers are also pushed as metrics.
+class Generator {
+public:
+  static std::shared_ptr<Generator> Create(const GeneratorConfig& config, std::shared_ptr<msgbus::Pusher> pusher) {
+    return std::make_shared<Generator>(config, pusher);
+  }
+
+  Generator(const GeneratorConfig& config, std::shared_ptr<msgbus::Pusher> pusher);
+  ~Generator();
+
+  void Start();
+  void Stop();
+
+  // False once the generator's duration has elapsed or it's been stopped.
+  bool Running();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  void run();
+  void publish(double elapsed);
+  void report(Clock::time_point now);
+
+  double next(std::size_t i, double elapsed);
+  double multiplier(double elapsed) const;
+
+  GeneratorConfig config;
+
+  std::shared_ptr<msgbus::Pusher> pusher;
+  std::shared_ptr<msgbus::MetricsPusher> metrics;
+
+  msgbus::MetricHandle pointCount;
+  msgbus::MetricHandle envelopeCount;
+  msgbus::MetricHandle lateCount;
+  msgbus::MetricHandle targetRate;
+
+  std::vector<double> values;
+  std::vector<double> phases;
+
+  std::mt19937 rand;
+
+  // Totals so far, and as of the last report.
+  std::uint64_t points    = 0;
+  std::uint64_t envelopes = 0;
+  std::uint64_t late      = 0;
+  std::uint64_t dropped   = 0;
+
+  std::uint64_t reportedPoints    = 0;
+  std::uint64_t reportedEnvelopes = 0;
+  std::uint64_t reportedLate      = 0;
+  std::uint64_t reportedDropped   = 0;
+
+  Clock::time_point lastReport;
+
+  bool running = false;
+  std::mutex mu;
+  std::condition_variable cv;
+
+  std::thread thread;
+};
+
+} // namespace load
+} // namespace otsim
+
+#endif // OTSIM_LOAD_GENERATOR_HPP
@@ -0,0 +1,262 @@
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include "fmt/format.h"
+
+#include "msgbus/pusher.hpp"
+
+#include "generator.hpp"
+
+namespace pt = boost::property_tree;
+
+std::condition_variable cv;
+std::mutex m;
+std::atomic<bool> interrupted {false};
+
+void signalHandler(int) {
+  interrupted = true;
+  cv.notify_one();
+}
+
+// Adds the tags of every point configured in the DNP3 and Modbus devices in
+// the given config, so load can be generated for the tags those devices
+// actually serve. Tags used by more than one point are only added once.
+void tagsFromConfig(const std::string& path, std::vector<otsim::load::Tag>& tags, std::set<std::string>& seen) {
+  pt::ptree tree;
+  pt::read_xml(path, tree);
+
+  auto root = tree.get_child("ot-sim");
+
+  auto add = [&](const std::string& name, bool binary) {
+    if (!name.empty() && seen.insert(name).second) {
+      tags.push_back(otsim::load::Tag{name, binary});
+    }
+  };
+
+  auto points = [&](const pt::ptree& parent) {
+    for (auto& kind : {"input", "output"}) {
+      auto range = parent.equal_range(kind);
+
+      for (auto iter = range.first; iter != range.second; ++iter) {
+        add(iter->second.get<std::string>("tag", ""), iter->second.get<std::string>("<xmlattr>.type", "") == "binary");
+      }
+    }
+  };
+
+  auto dnp3 = root.equal_range("dnp3");
+  for (auto iter = dnp3.first; iter != dnp3.second; ++iter) {
+    for (auto& role : {"outstation", "master"}) {
+      auto range = iter->second.equal_range(role);
+
+      for (auto it = range.first; it != range.second; ++it) {
+        points(it->second);
+      }
+    }
+  }
+
+  auto modbus = root.equal_range("modbus");
+  for (auto iter = modbus.first; iter != modbus.second; ++iter) {
+    auto registers = iter->second.equal_range("register");
+
+    for (auto it = registers.first; it != registers.second; ++it) {
+      auto typ = it->second.get<std::string>("<xmlattr>.type", "");
+      add(it->second.get<std::string>("tag", ""), typ == "coil" || typ == "discrete");
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "ERROR: missing path to XML config file" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::shared_ptr<otsim::load::Generator>> generators;
+
+  // Generators using the same endpoint and settings share a single pusher.
+  std::map<std::string, std::shared_ptr<otsim::msgbus::Pusher>> pushers;
+
+  pt::ptree tree;
+  pt::read_xml(argv[1], tree);
+
+  BOOST_FOREACH(pt::ptree::value_type &v, tree) {
+    if (v.first.compare("ot-sim") != 0) {
+      std::cerr << "ERROR: missing root 'ot-sim' element in XML config" << std::endl;
+      return 1;
+    }
+
+    std::string pullEndpoint    = "tcp://127.0.0.1:1234";
+    std::string pullEncoding    = "json";
+    std::string pullQueuePolicy = "block";
+    std::size_t pullQueueSize   = 4096;
+
+    try {
+      auto msgbus = v.second.get_child("message-bus");
+      pullEndpoint = msgbus.get<std::string>("pull-endpoint", pullEndpoint);
+      pullEncoding = msgbus.get<std::string>("pull-endpoint.<xmlattr>.encoding", pullEncoding);
+      pullQueuePolicy = msgbus.get<std::string>("pull-endpoint.<xmlattr>.queue-policy", pullQueuePolicy);
+      pullQueueSize = msgbus.get<std::size_t>("pull-endpoint.<xmlattr>.queue-size", pullQueueSize);
+    } catch (pt::ptree_bad_path&) {}
+
+    auto loads = v.second.equal_range("load");
+    for (auto iter = loads.first; iter != loads.second; ++iter) {
+      auto load = iter->second;
+
+      otsim::load::GeneratorConfig config;
+
+      config.name  = load.get<std::string>("<xmlattr>.name", "load");
+      config.topic = load.get<std::string>("topic", config.topic);
+
+      std::set<std::string> seen;
+
+      auto from = load.equal_range("tags-from");
+      for (auto it = from.first; it != from.second; ++it) {
+        // An empty element means this config file.
+        auto path = it->second.get_value<std::string>();
+
+        try {
+          tagsFromConfig(path.empty() ? argv[1] : path, config.tags, seen);
+        } catch (const pt::ptree_error& e) {
+          std::cerr << fmt::format("ERROR: unable to read tags for load generator {} from {}: {}", config.name, path, e.what()) << std::endl;
+          return 1;
+        }
+      }
+
+      // Synthetic tags, named by replacing {} in the element's value with each
+      // index from zero to count (or appending the index if there isn't one).
+      auto synthetic = load.equal_range("tags");
+      for (auto it = synthetic.first; it != synthetic.second; ++it) {
+        auto pattern = it->second.get_value<std::string>();
+        auto count   = it->second.get<std::size_t>("<xmlattr>.count", 1);
+        auto binary  = it->second.get<std::string>("<xmlattr>.type", "analog") == "binary";
+
+        for (std::size_t i = 0; i < count; ++i) {
+          auto name = pattern;
+          auto pos  = name.find("{}");
+
+          if (pos == std::string::npos) {
+            name += fmt::format("-{}", i);
+          } else {
+            name.replace(pos, 2, std::to_string(i));
+          }
+
+          if (seen.insert(name).second) {
+            config.tags.push_back(otsim::load::Tag{name, binary});
+          }
+        }
+      }
+
+      if (config.tags.empty()) {
+        std::cerr << fmt::format("ERROR: no tags configured for load generator {}", config.name) << std::endl;
+        return 1;
+      }
+
+      config.rate     = load.get<double>("rate", config.rate);
+      config.points   = load.get<std::size_t>("points-per-message", config.points);
+      config.duration = std::chrono::seconds(load.get<std::uint64_t>("duration", 0));
+      config.report   = std::chrono::seconds(load.get<std::uint64_t>("report-interval", 5));
+
+      if (config.rate <= 0 || config.points == 0) {
+        std::cerr << fmt::format("ERROR: rate and points per message must be positive for load generator {}", config.name) << std::endl;
+        return 1;
+      }
+
+      if (auto dist = load.get_child_optional("distribution")) {
+        auto& d = config.distribution;
+
+        d.type   = dist->get<std::string>("<xmlattr>.type", d.type);
+        d.min    = dist->get<double>("<xmlattr>.min", d.min);
+        d.max    = dist->get<double>("<xmlattr>.max", d.max);
+        d.mean   = dist->get<double>("<xmlattr>.mean", d.mean);
+        d.stddev = dist->get<double>("<xmlattr>.stddev", d.stddev);
+        d.step   = dist->get<double>("<xmlattr>.step", d.step);
+        d.period = dist->get<double>("<xmlattr>.period", d.period);
+        d.flip   = dist->get<double>("<xmlattr>.flip", d.flip);
+
+        if (d.type != "uniform" && d.type != "normal" && d.type != "random-walk" && d.type != "sine") {
+          std::cerr << fmt::format("ERROR: invalid distribution {} for load generator {}", d.type, config.name) << std::endl;
+          return 1;
+        }
+      }
+
+      if (auto burst = load.get_child_optional("burst")) {
+        config.burst.period     = burst->get<double>("<xmlattr>.period", 0.0);
+        config.burst.duration   = burst->get<double>("<xmlattr>.duration", 0.0);
+        config.burst.multiplier = burst->get<double>("<xmlattr>.multiplier", 1.0);
+
+        if (config.burst.multiplier <= 0) {
+          std::cerr << fmt::format("ERROR: burst multiplier must be positive for load generator {}", config.name) << std::endl;
+          return 1;
+        }
+      }
+
+      otsim::msgbus::PusherConfig pusherConfig;
+
+      try {
+        pusherConfig.encoding    = otsim::msgbus::ParseEncoding(load.get<std::string>("pull-endpoint.<xmlattr>.encoding", pullEncoding));
+        pusherConfig.queuePolicy = otsim::msgbus::ParseQueuePolicy(load.get<std::string>("pull-endpoint.<xmlattr>.queue-policy", pullQueuePolicy));
+        pusherConfig.queueSize   = load.get<std::size_t>("pull-endpoint.<xmlattr>.queue-size", pullQueueSize);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << fmt::format("ERROR: {} for load generator {}", e.what(), config.name) << std::endl;
+        return 1;
+      }
+
+      auto endpoint = load.get<std::string>("pull-endpoint", pullEndpoint);
+
+      auto key = fmt::format("{}|{}|{}|{}", endpoint,
+        static_cast<int>(pusherConfig.encoding), static_cast<int>(pusherConfig.queuePolicy), pusherConfig.queueSize);
+
+      if (!pushers.count(key)) {
+        pushers[key] = otsim::msgbus::Pusher::Create(endpoint, pusherConfig);
+      }
+
+      std::cout << fmt::format("starting load generator {}: {} tags at {}/sec on {}", config.name, config.tags.size(), config.rate, config.topic) << std::endl;
+
+      generators.push_back(otsim::load::Generator::Create(config, pushers[key]));
+    }
+  }
+
+  if (generators.empty()) {
+    std::cerr << "ERROR: no load generators configured" << std::endl;
+    return 1;
+  }
+
+  for (auto& generator : generators) {
+    generator->Start();
+  }
+
+  std::signal(SIGINT, signalHandler);
+
+  // Run until interrupted or every generator's duration has elapsed.
+  {
+    std::unique_lock lk(m);
+
+    while (!interrupted) {
+      bool running = false;
+
+      for (auto& generator : generators) {
+        running = generator->Running() || running;
+      }
+
+      if (!running) {
+        break;
+      }
+
+      cv.wait_for(lk, std::chrono::seconds(1));
+    }
+  }
+
+  for (auto& generator : generators) {
+    generator->Stop();
+  }
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <sstream>
+
+#include "bench.hpp"
+
+static std::atomic<std::uint64_t> allocations {0};
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace bench {
+
+std::uint64_t Allocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+Measurement Measure(double minSeconds, std::function<void()> fn) {
+  // warm up any reused storage before measuring
+  fn();
+
+  Measurement m;
+
+  for (std::uint64_t iterations = 1; ; iterations *= 2) {
+    auto before = Allocations();
+    auto start  = std::chrono::steady_clock::now();
+
+    for (std::uint64_t i = 0; i < iterations; ++i) {
+      fn();
+    }
+
+    m.seconds    = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m.allocs     = Allocations() - before;
+    m.iterations = iterations;
+
+    if (m.seconds >= minSeconds) {
+      return m;
+    }
+  }
+}
+
+json Percentiles(std::vector<double>& samples) {
+  json j = {{"count", samples.size()}};
+
+  if (samples.empty()) {
+    return j;
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  auto at = [&](double q) {
+    return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))];
+  };
+
+  j["mean"] = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+  j["min"]  = samples.front();
+  j["p50"]  = at(0.5);
+  j["p90"]  = at(0.9);
+  j["p99"]  = at(0.99);
+  j["p999"] = at(0.999);
+  j["max"]  = samples.back();
+
+  return j;
+}
+
+json Report(const std::string& name, const json& results) {
+  json build = {
+    {"version", OTSIM_BENCH_VERSION},
+    {"type", OTSIM_BENCH_BUILD_TYPE},
+#ifdef __VERSION__
+    {"compiler", __VERSION__},
+#endif
+  };
+
+  return {
+    {"benchmark", name},
+    {"build", build},
+    {"results", results},
+  };
+}
+
+std::vector<std::string> Split(const std::string& list) {
+  std::vector<std::string> parts;
+  std::stringstream stream(list);
+
+  for (std::string part; std::getline(stream, part, ',');) {
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+  }
+
+  return parts;
+}
+
+} // namespace bench
@@ -0,0 +1,50 @@
+#ifndef OTSIM_MSGBUS_BENCH_HPP
+#define OTSIM_MSGBUS_BENCH_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// Shared by the message bus benchmarks. Every benchmark writes a single JSON
+// document to stdout (progress goes to stderr) so results from different
+// builds can be saved and compared:
+//
+//   {
+//     "benchmark": "codec",
+//     "build": {"version": "...", "type": "...", "compiler": "..."},
+//     "results": [{...}, ...]
+//   }
+namespace bench {
+
+// Heap allocations made by the process so far. Every benchmark executable
+// counts them by replacing the global operator new.
+std::uint64_t Allocations();
+
+struct Measurement {
+  std::uint64_t iterations {};
+  double        seconds    {};
+  std::uint64_t allocs     {};
+};
+
+// Runs fn once to warm up, then repeatedly (doubling the number of iterations
+// each round) until a round takes at least minSeconds.
+Measurement Measure(double minSeconds, std::function<void()> fn);
+
+// Returns {"count", "mean", "min", "p50", "p90", "p99", "p999", "max"} of the
+// given samples, which are sorted in place.
+json Percentiles(std::vector<double>& samples);
+
+// Wraps the given results in the document described above.
+json Report(const std::string& name, const json& results);
+
+// Parses a comma separated list, such as "1,10,100".
+std::vector<std::string> Split(const std::string& list);
+
+} // namespace bench
+
+#endif // OTSIM_MSGBUS_BENCH_HPP
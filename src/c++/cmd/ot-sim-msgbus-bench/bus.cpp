@@ -0,0 +1,420 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+#include "bench.hpp"
+
+#include "msgbus/context.hpp"
+#include "msgbus/envelope.hpp"
+#include "msgbus/pusher.hpp"
+#include "msgbus/subscriber.hpp"
+
+using namespace otsim::msgbus;
+
+const std::string TOPIC = "BENCH";
+
+// Metadata keys used to match received envelopes up with when they were sent.
+const std::string RUN      = "bench-run";
+const std::string SEQUENCE = "bench-seq";
+const std::string SENT     = "bench-sent-ns";
+
+static std::uint64_t now() {
+  auto since = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(since).count();
+}
+
+// Stand-in for ot-sim-message-bus, forwarding everything pushed to it to its
+// subscribers the same way it does (without any of its optional features), so
+// the benchmark can run over any transport without an external broker. inproc
+// only works within a process, so it can only be benchmarked this way.
+class Broker {
+public:
+  Broker(const std::string& pullEndpoint, const std::string& pubEndpoint) {
+    pull = zmq::socket_t(Context(), ZMQ_PULL);
+    pub  = zmq::socket_t(Context(), ZMQ_PUB);
+
+    pull.set(zmq::sockopt::linger, 0);
+    pub.set(zmq::sockopt::linger, 0);
+
+    pull.bind(pullEndpoint);
+    pub.bind(pubEndpoint);
+
+    // Resolves wildcard TCP ports to the ones actually bound.
+    PullEndpoint = pull.get(zmq::sockopt::last_endpoint);
+    PubEndpoint  = pub.get(zmq::sockopt::last_endpoint);
+
+    running.store(true);
+    thread = std::thread(&Broker::run, this);
+  }
+
+  ~Broker() {
+    running.store(false);
+
+    if (thread.joinable()) {
+      thread.join();
+    }
+
+    pull.close();
+    pub.close();
+  }
+
+  std::string PullEndpoint;
+  std::string PubEndpoint;
+
+private:
+  void run() {
+    std::vector<zmq::pollitem_t> items = {{pull, 0, ZMQ_POLLIN, 0}};
+
+    while (running) {
+      zmq::poll(items, std::chrono::milliseconds(100));
+
+      if (!(items[0].revents & ZMQ_POLLIN)) {
+        continue;
+      }
+
+      zmq::message_t frame;
+
+      while (pull.recv(frame, zmq::recv_flags::dontwait)) {
+        auto flags = frame.more() ? zmq::send_flags::sndmore : zmq::send_flags::none;
+        pub.send(frame, flags);
+      }
+    }
+  }
+
+  zmq::socket_t pull;
+  zmq::socket_t pub;
+
+  std::atomic<bool> running;
+  std::thread thread;
+};
+
+struct Options {
+  Encoding    encoding {Encoding::JSON};
+  std::string name     {"json"};
+  std::uint64_t points     {10};
+  std::uint64_t latency    {10000};
+  std::uint64_t throughput {100000};
+};
+
+// Pushes envelopes from a Pusher to a Subscriber through the broker at the
+// given endpoints, measuring the latency of each one.
+class Run {
+public:
+  Run(const std::string& pull, const std::string& pub, const Options& opts) : opts(opts) {
+    PusherConfig config;
+    config.encoding = opts.encoding;
+
+    pusher     = Pusher::Create(pull, config);
+    subscriber = Subscriber::Create(pub);
+
+    for (std::uint64_t i = 0; i < opts.points; ++i) {
+      env.contents.measurements.push_back(Point{"bench-" + std::to_string(i) + ".value", i * 1.5, i});
+    }
+
+    subscriber->AddHandler(std::bind(&Run::handle, this, std::placeholders::_1));
+    subscriber->Start(TOPIC);
+  }
+
+  ~Run() {
+    subscriber->Stop();
+  }
+
+  // Subscriptions take a moment to reach the broker, and anything published
+  // before then is dropped, so push until something gets through.
+  bool WarmUp() {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+      pusher->Push(TOPIC, env);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+      if (warm) {
+        // Let any other warm up envelopes still in flight arrive.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Pushes envelopes one at a time, waiting for each one to be received
+  // before pushing the next, so latencies aren't affected by queueing.
+  json Latency() {
+    reset(opts.latency);
+
+    for (std::uint64_t i = 0; i < opts.latency; ++i) {
+      push(i);
+
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+      while (received.load(std::memory_order_acquire) <= i && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+    }
+
+    return result("latency", opts.latency, 0);
+  }
+
+  // Pushes envelopes as fast as possible, measuring how fast they're received
+  // and how many are dropped along the way (by PUB sockets hitting their high
+  // water mark).
+  json Throughput() {
+    reset(opts.throughput);
+
+    auto start = now();
+
+    for (std::uint64_t i = 0; i < opts.throughput; ++i) {
+      push(i);
+    }
+
+    // Wait for everything to arrive, or for envelopes to stop arriving.
+    std::uint64_t previous = 0;
+
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+      auto count = received.load(std::memory_order_acquire);
+
+      if (count == opts.throughput || count == previous) {
+        break;
+      }
+
+      previous = count;
+    }
+
+    auto last = lastReceived.load();
+    return result("throughput", opts.throughput, last > start ? last - start : 0);
+  }
+
+private:
+  // Stragglers from the previous benchmark may still be arriving, so the run
+  // is moved on before anything they'd update is cleared.
+  void reset(std::uint64_t count) {
+    auto lock = std::unique_lock<std::mutex>(mu);
+
+    run.fetch_add(1);
+    latencies.assign(count, -1);
+    received.store(0);
+    lastReceived.store(0);
+  }
+
+  void push(std::uint64_t seq) {
+    auto copy = env;
+
+    copy.metadata[RUN]      = std::to_string(run.load());
+    copy.metadata[SEQUENCE] = std::to_string(seq);
+    copy.metadata[SENT]     = std::to_string(now());
+
+    pusher->Push(TOPIC, copy);
+  }
+
+  void handle(const Envelope<Status>& env) {
+    auto at = now();
+
+    auto id   = env.metadata.find(RUN);
+    auto seq  = env.metadata.find(SEQUENCE);
+    auto sent = env.metadata.find(SENT);
+
+    if (id == env.metadata.end() || seq == env.metadata.end() || sent == env.metadata.end()) {
+      warm = true;
+      return;
+    }
+
+    auto r = std::stoi(id->second);
+    auto i = std::stoull(seq->second);
+    auto l = (at - std::stoull(sent->second)) / 1000.0;
+
+    auto lock = std::unique_lock<std::mutex>(mu);
+
+    // Stragglers from a previous benchmark.
+    if (r != run.load()) {
+      return;
+    }
+
+    if (i < latencies.size()) {
+      latencies[i] = l;
+    }
+
+    lastReceived.store(at);
+    received.fetch_add(1, std::memory_order_release);
+  }
+
+  json result(const std::string& mode, std::uint64_t sent, std::uint64_t elapsed) {
+    std::vector<double> samples;
+
+    {
+      auto lock = std::unique_lock<std::mutex>(mu);
+
+      for (auto latency : latencies) {
+        if (latency >= 0) {
+          samples.push_back(latency);
+        }
+      }
+    }
+
+    json j = {
+      {"mode", mode},
+      {"encoding", opts.name},
+      {"points", opts.points},
+      {"sent", sent},
+      {"received", samples.size()},
+      {"lost", sent - samples.size()},
+      {"latency_us", bench::Percentiles(samples)},
+    };
+
+    if (elapsed > 0) {
+      j["seconds"]      = elapsed / 1e9;
+      j["msgs_per_sec"] = j["received"].get<double>() / (elapsed / 1e9);
+    }
+
+    return j;
+  }
+
+  Options opts;
+
+  std::shared_ptr<Pusher>     pusher;
+  std::shared_ptr<Subscriber> subscriber;
+
+  Envelope<Status> env = NewEnvelope("bench", Status{});
+
+  std::atomic<bool> warm {false};
+  std::atomic<int>  run  {0};
+
+  // Guards latencies, and makes checking the run and counting a received
+  // envelope atomic with respect to reset. Envelopes can still be arriving
+  // when a benchmark gives up waiting for them, and when the next one starts.
+  std::mutex mu;
+  std::vector<double> latencies;
+
+  // Written under mu, but atomic so they can be polled without it.
+  std::atomic<std::uint64_t> received {0};
+  std::atomic<std::uint64_t> lastReceived {0};
+};
+
+static bool benchmark(json& results, const std::string& transport, const std::string& pull, const std::string& pub, const Options& opts) {
+  std::cerr << "benchmarking " << transport << " (" << pull << " -> " << pub << ")" << std::endl;
+
+  Run run(pull, pub, opts);
+
+  if (!run.WarmUp()) {
+    std::cerr << "no messages received over " << transport << std::endl;
+    return false;
+  }
+
+  std::vector<json> runs = {run.Latency()};
+  runs.push_back(run.Throughput());
+
+  for (auto& result : runs) {
+    result["transport"] = transport;
+
+    std::cerr << "  " << result["mode"].get<std::string>() << ": p50 " << result["latency_us"].value("p50", 0.0)
+      << " us, p99 " << result["latency_us"].value("p99", 0.0) << " us";
+
+    if (result.contains("msgs_per_sec")) {
+      std::cerr << ", " << static_cast<std::uint64_t>(result["msgs_per_sec"].get<double>()) << " msgs/sec";
+    }
+
+    std::cerr << ", " << result["lost"] << " lost" << std::endl;
+
+    results.push_back(result);
+  }
+
+  return true;
+}
+
+static void usage(const char* name) {
+  std::cerr << "usage: " << name << " [options]" << std::endl << std::endl;
+  std::cerr << "Measures Pusher -> broker -> Subscriber latency and throughput." << std::endl << std::endl;
+  std::cerr << "  -t TRANSPORTS  comma separated transports to benchmark using an in-process" << std::endl;
+  std::cerr << "                 broker (default tcp,ipc,inproc)" << std::endl;
+  std::cerr << "  -b PULL,PUB    benchmark an external broker (such as ot-sim-message-bus) at" << std::endl;
+  std::cerr << "                 the given endpoints instead" << std::endl;
+  std::cerr << "  -e ENCODING    envelope encoding, json or binary (default json)" << std::endl;
+  std::cerr << "  -p POINTS      points per Status envelope (default 10)" << std::endl;
+  std::cerr << "  -n COUNT       envelopes to push one at a time for latency (default 10000)" << std::endl;
+  std::cerr << "  -m COUNT       envelopes to push at once for throughput (default 100000)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string transports = "tcp,ipc,inproc";
+  std::string external;
+
+  Options opts;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:b:e:p:n:m:h")) != -1) {
+    switch (opt) {
+      case 't':
+        transports = optarg;
+        break;
+      case 'b':
+        external = optarg;
+        break;
+      case 'e':
+        try {
+          opts.encoding = ParseEncoding(optarg);
+          opts.name     = optarg;
+        } catch (const std::invalid_argument& e) {
+          std::cerr << e.what() << std::endl;
+          return 1;
+        }
+
+        break;
+      case 'p':
+        opts.points = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'n':
+        opts.latency = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'm':
+        opts.throughput = std::strtoull(optarg, nullptr, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  json results = json::array();
+  bool ok = true;
+
+  if (!external.empty()) {
+    auto endpoints = bench::Split(external);
+
+    if (endpoints.size() != 2) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    ok = benchmark(results, "external", endpoints[0], endpoints[1], opts);
+  } else {
+    for (auto& transport : bench::Split(transports)) {
+      std::string pull, pub;
+
+      if (transport == "tcp") {
+        pull = pub = "tcp://127.0.0.1:*";
+      } else if (transport == "ipc") {
+        pull = "ipc:///tmp/ot-sim-msgbus-bench-" + std::to_string(getpid()) + "-pull";
+        pub  = "ipc:///tmp/ot-sim-msgbus-bench-" + std::to_string(getpid()) + "-pub";
+      } else if (transport == "inproc") {
+        pull = "inproc://ot-sim-msgbus-bench-pull";
+        pub  = "inproc://ot-sim-msgbus-bench-pub";
+      } else {
+        std::cerr << "unknown transport " << transport << std::endl;
+        return 1;
+      }
+
+      Broker broker(pull, pub);
+
+      ok = benchmark(results, transport, broker.PullEndpoint, broker.PubEndpoint, opts) && ok;
+    }
+  }
+
+  std::cout << bench::Report("bus", results).dump(2) << std::endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <unistd.h>
+
+#include "bench.hpp"
+
+#include "msgbus/codec.hpp"
+#include "msgbus/decoder.hpp"
+#include "msgbus/envelope.hpp"
+
+using namespace otsim::msgbus;
+
+static Points points(std::uint64_t count) {
+  Points p;
+
+  for (std::uint64_t i = 0; i < count; ++i) {
+    p.push_back(Point{"bus-" + std::to_string(i) + ".voltage", 1.0 + i * 0.001, 1650000000000 + i});
+  }
+
+  return p;
+}
+
+static Metrics metrics(std::uint64_t count) {
+  Metrics m;
+
+  for (std::uint64_t i = 0; i < count; ++i) {
+    m.metrics.push_back(Metric{.kind = i % 2 ? "Gauge" : "Counter", .name = "bench_metric_" + std::to_string(i), .desc = "benchmark metric", .value = i * 1.5});
+  }
+
+  return m;
+}
+
+// Guards against the compiler optimizing away work whose result isn't used.
+static std::size_t sink = 0;
+
+static void decode(Decoder& decoder, const std::string& data) {
+  auto& kind = decoder.Decode(data.data(), data.size());
+
+  if (kind == "Status") {
+    sink += decoder.StatusEnvelope().contents.measurements.size();
+  } else if (kind == "Update") {
+    sink += decoder.UpdateEnvelope().contents.updates.size();
+  }
+}
+
+// The decode path used by Subscriber prior to the SAX decoder, and still the
+// only way to decode JSON envelopes of other kinds.
+template<typename T>
+static void decodeDOM(const std::string& data) {
+  auto j = json::parse(data);
+  auto env = j.get<Envelope<T>>();
+
+  sink += env.kind.size();
+}
+
+template<typename T>
+static void run(json& results, double seconds, const std::string& kind, std::uint64_t count, Envelope<T> env) {
+  Decoder decoder;
+
+  for (auto encoding : {Encoding::JSON, Encoding::Binary}) {
+    auto name = encoding == Encoding::JSON ? "json" : "binary";
+    auto data = Encode(env, encoding);
+
+    auto record = [&](const std::string& op, const bench::Measurement& m) {
+      std::cerr << kind << " " << count << " " << name << " " << op << ": "
+        << static_cast<std::uint64_t>(m.iterations / m.seconds) << " msgs/sec" << std::endl;
+
+      results.push_back({
+        {"kind", kind},
+        {"points", count},
+        {"encoding", name},
+        {"op", op},
+        {"bytes", data.size()},
+        {"iterations", m.iterations},
+        {"ns_per_op", m.seconds * 1e9 / m.iterations},
+        {"msgs_per_sec", m.iterations / m.seconds},
+        {"allocs_per_op", static_cast<double>(m.allocs) / m.iterations},
+      });
+    };
+
+    record("encode", bench::Measure(seconds, [&]() {
+      sink += Encode(env, encoding).size();
+    }));
+
+    // Decoder only decodes the contents of Status and Update envelopes.
+    if constexpr (std::is_same_v<T, Metrics>) {
+      if (encoding == Encoding::Binary) {
+        Envelope<Metrics> decoded;
+
+        record("decode", bench::Measure(seconds, [&]() {
+          DecodeBinary(data.data(), data.size(), decoded);
+          sink += decoded.contents.metrics.size();
+        }));
+      } else {
+        record("decode", bench::Measure(seconds, [&]() { decodeDOM<T>(data); }));
+      }
+    } else {
+      record("decode", bench::Measure(seconds, [&]() { decode(decoder, data); }));
+
+      if (encoding == Encoding::JSON) {
+        record("decode-dom", bench::Measure(seconds, [&]() { decodeDOM<T>(data); }));
+      }
+    }
+  }
+}
+
+static void usage(const char* name) {
+  std::cerr << "usage: " << name << " [-p POINTS] [-s SECONDS]" << std::endl << std::endl;
+  std::cerr << "Measures encoding and decoding Status, Update and Metric envelopes." << std::endl << std::endl;
+  std::cerr << "  -p POINTS   comma separated numbers of points per envelope (default 1,10,100,1000)" << std::endl;
+  std::cerr << "  -s SECONDS  minimum time to spend measuring each case (default 0.5)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string counts = "1,10,100,1000";
+  double seconds = 0.5;
+
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:s:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        counts = optarg;
+        break;
+      case 's':
+        seconds = std::atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  json results = json::array();
+
+  for (auto& c : bench::Split(counts)) {
+    auto count = std::strtoull(c.c_str(), nullptr, 10);
+
+    run(results, seconds, "Status", count, NewEnvelope("bench", Status{.measurements = points(count)}));
+    run(results, seconds, "Update", count, NewEnvelope("bench", Update{.updates = points(count), .recipient = "bench"}));
+    run(results, seconds, "Metric", count, NewEnvelope("bench", metrics(count)));
+  }
+
+  std::cout << bench::Report("codec", results).dump(2) << std::endl;
+
+  return sink == 0;
+}
@@ -0,0 +1,90 @@
+#ifndef OTSIM_DNP3_ASYNC_HPP
+#define OTSIM_DNP3_ASYNC_HPP
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include "msgbus/scheduler.hpp"
+
+namespace otsim {
+namespace dnp3 {
+
+// AsyncResult is the promise side of a future returned by the asynchronous
+// master operations. It's satisfied exactly once, either with the result
+// reported by opendnp3 or, if that doesn't arrive before the timeout, with the
+// value given for timeouts. If it's destroyed without being satisfied (such as
+// when opendnp3 drops a callback without calling it), it's satisfied with the
+// value given for abandoned results instead, so futures never end in a broken
+// promise. Timeouts are tracked on the shared scheduler, so waiting on many
+// results doesn't need a thread per result.
+template <typename T>
+class AsyncResult : public std::enable_shared_from_this<AsyncResult<T>> {
+public:
+  // A zero timeout means never time out.
+  static std::shared_ptr<AsyncResult<T>> Create(std::chrono::milliseconds timeout, T onTimeout, T onAbandoned) {
+    auto result = std::make_shared<AsyncResult<T>>(std::move(onAbandoned));
+
+    if (timeout.count() > 0) {
+      std::weak_ptr<AsyncResult<T>> weak = result;
+
+      auto lock = std::unique_lock<std::mutex>(result->mu);
+
+      result->timer = otsim::msgbus::SharedScheduler().After(timeout, [weak, onTimeout]() {
+        if (auto result = weak.lock()) {
+          result->Set(onTimeout);
+        }
+      });
+    }
+
+    return result;
+  }
+
+  AsyncResult(T onAbandoned) : onAbandoned(std::move(onAbandoned)) {}
+
+  ~AsyncResult() {
+    Set(std::move(onAbandoned));
+  }
+
+  // Can only be called once.
+  std::future<T> Future() { return promise.get_future(); }
+
+  // Returns false if the result has already been set.
+  bool Set(T value) {
+    otsim::msgbus::Scheduler::TaskID pending;
+
+    {
+      auto lock = std::unique_lock<std::mutex>(mu);
+
+      if (done) {
+        return false;
+      }
+
+      done    = true;
+      pending = timer;
+
+      promise.set_value(std::move(value));
+    }
+
+    // Not holding the lock, since canceling waits for the timeout task if it's
+    // running, and it needs the lock to find out it's too late.
+    otsim::msgbus::SharedScheduler().Cancel(pending);
+
+    return true;
+  }
+
+private:
+  std::mutex mu;
+  std::promise<T> promise;
+
+  T onAbandoned;
+
+  bool done {};
+  otsim::msgbus::Scheduler::TaskID timer {};
+};
+
+} // namespace dnp3
+} // namespace otsim
+
+#endif // OTSIM_DNP3_ASYNC_HPP
@@ -2,18 +2,20 @@
 #include <thread>
 
 #include "client.hpp"
+#include "manager.hpp"
 
-#include "opendnp3/ConsoleLogger.h"
 #include "opendnp3/master/DefaultMasterApplication.h"
 
 namespace otsim {
 namespace dnp3 {
 
 Client::Client() {
-    manager.reset(new opendnp3::DNP3Manager(std::thread::hardware_concurrency(), opendnp3::ConsoleLogger::Create()));
+    manager = SharedManager();
 }
 
 bool Client::Init(const std::string& id, const opendnp3::IPEndpoint endpoint, std::shared_ptr<opendnp3::IChannelListener> listener, const opendnp3::ChannelRetry channelRetry) {
+    logger.SetName(id);
+
     try {
         channel = manager->AddTCPClient(
             id,
@@ -24,7 +26,7 @@ bool Client::Init(const std::string& id, const opendnp3::IPEndpoint endpoint, st
             listener
         );
     } catch (std::exception& e) {
-        std::cout << "Failed to add TCPClient due to the error: " << std::string(e.what());
+        logger.Error("failed to add TCP client: {}", e.what());
         return false;
     }
 
@@ -32,6 +34,8 @@ bool Client::Init(const std::string& id, const opendnp3::IPEndpoint endpoint, st
 }
 
 bool Client::Init(const std::string& id, const opendnp3::SerialSettings serial, std::shared_ptr<opendnp3::IChannelListener> listener, const opendnp3::ChannelRetry channelRetry) {
+    logger.SetName(id);
+
     try {
         channel = manager->AddSerial(
             id,
@@ -41,7 +45,7 @@ bool Client::Init(const std::string& id, const opendnp3::SerialSettings serial,
             listener
         );
     } catch (std::exception& e) {
-        std::cout << "Failed to add TCPClient due to the error: " << std::string(e.what());
+        logger.Error("failed to add serial client: {}", e.what());
         return false;
     }
 
@@ -49,7 +53,7 @@ bool Client::Init(const std::string& id, const opendnp3::SerialSettings serial,
 }
 
 std::shared_ptr<Master> Client::AddMaster(std::string id, std::uint16_t local, std::uint16_t remote, std::int64_t timeout, Pusher pusher) {
-    std::cout << "adding master " << local << " --> " << remote << std::endl;
+    logger.Info("adding master {} --> {}", local, remote);
 
     auto master = Master::Create(id, pusher);
     auto config = master->BuildConfig(local, remote, timeout);
@@ -64,7 +68,7 @@ std::shared_ptr<Master> Client::AddMaster(std::string id, std::uint16_t local, s
 
 void Client::Start() {
     for (const auto& kv : masters) {
-        std::cout << "enabling master to " << kv.first << std::endl;
+        logger.Info("enabling master to {}", kv.first);
 
         kv.second->Enable();
     }
@@ -72,7 +76,7 @@ void Client::Start() {
 
 void Client::Stop() {
     for (const auto& kv : masters) {
-        std::cout << "disabling master to " << kv.first << std::endl;
+        logger.Info("disabling master to {}", kv.first);
 
         kv.second->Disable();
     }
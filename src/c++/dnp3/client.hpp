@@ -2,6 +2,7 @@
 #define OTSIM_DNP3_CLIENT_HPP
 
 #include "common.hpp"
+#include "logger.hpp"
 #include "master.hpp"
 
 #include "opendnp3/DNP3Manager.h"
@@ -28,9 +29,11 @@ public:
   void Stop();
 
 private:
-  std::shared_ptr<opendnp3::DNP3Manager> manager; // DNP3 stack manager
+  std::shared_ptr<opendnp3::DNP3Manager> manager; // Shared DNP3 stack manager
   std::shared_ptr<opendnp3::IChannel> channel;    // TCPServer channel
 
+  Logger logger {"dnp3"}; // renamed to the channel ID by Init
+
   std::map<std::uint16_t, std::shared_ptr<Master>> masters;
 };
 
@@ -0,0 +1,198 @@
+#include <condition_variable>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "logger.hpp"
+
+#include "msgbus/queue.hpp"
+
+namespace otsim {
+namespace dnp3 {
+
+namespace {
+
+struct Entry {
+  LogLevel    level {};
+  std::string text  {};
+};
+
+// Writer owns the background thread that writes log messages to the console.
+// Debug and info messages go to stdout, warnings and errors to stderr. Streams
+// are only flushed once the queue has been drained, rather than per message.
+class Writer {
+public:
+  Writer() : queue(16384) {
+    thread = std::thread(&Writer::run, this);
+  }
+
+  ~Writer() {
+    running.store(false);
+
+    {
+      std::lock_guard<std::mutex> lock(waitMu);
+    }
+
+    waitCV.notify_one();
+
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  void Push(LogLevel level, std::string text) {
+    Entry entry = {level, std::move(text)};
+
+    if (!queue.TryPush(entry)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (waiting.load()) {
+      {
+        std::lock_guard<std::mutex> lock(waitMu);
+      }
+
+      waitCV.notify_one();
+    }
+  }
+
+  std::uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+  void run() {
+    Entry entry;
+    std::uint64_t reported = 0;
+
+    while (true) {
+      if (queue.TryPop(entry)) {
+        auto& out = entry.level >= LogLevel::Warn ? std::cerr : std::cout;
+        out << entry.text << '\n';
+
+        continue;
+      }
+
+      auto count = dropped.load(std::memory_order_relaxed);
+
+      if (count != reported) {
+        std::cerr << "WARN: [logger] dropped " << count - reported << " log messages" << '\n';
+        reported = count;
+      }
+
+      std::cout.flush();
+      std::cerr.flush();
+
+      // Only exit once the queue has been drained.
+      if (!running) {
+        break;
+      }
+
+      // See Pusher::run for why this is safe without producers always locking.
+      waiting.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      {
+        std::unique_lock<std::mutex> lock(waitMu);
+        waitCV.wait_for(lock, std::chrono::milliseconds(100), [this]() { return !queue.Empty() || !running; });
+      }
+
+      waiting.store(false);
+    }
+  }
+
+  otsim::msgbus::BoundedQueue<Entry> queue;
+  std::atomic<std::uint64_t> dropped {0};
+
+  std::atomic<bool> running {true};
+  std::thread thread;
+
+  std::atomic<bool> waiting {false};
+  std::mutex waitMu;
+  std::condition_variable waitCV;
+};
+
+Writer& writer() {
+  // Destroyed at exit, which drains anything still queued.
+  static Writer w;
+  return w;
+}
+
+const char* levelPrefix(LogLevel level) {
+  switch (level) {
+    case LogLevel::Warn:
+      return "WARN: ";
+    case LogLevel::Error:
+      return "ERROR: ";
+    default:
+      return "";
+  }
+}
+
+} // namespace
+
+LogLevel ParseLogLevel(const std::string& name) {
+  if (name == "debug") {
+    return LogLevel::Debug;
+  }
+
+  if (name == "info") {
+    return LogLevel::Info;
+  }
+
+  if (name == "warn" || name == "warning") {
+    return LogLevel::Warn;
+  }
+
+  if (name == "error") {
+    return LogLevel::Error;
+  }
+
+  throw std::invalid_argument("unknown log level " + name);
+}
+
+std::uint64_t Logger::Dropped() {
+  return writer().Dropped();
+}
+
+bool Logger::allow(const char* format, std::uint64_t& suppressed) {
+  if (rateLimit == 0) {
+    return true;
+  }
+
+  auto now  = std::chrono::steady_clock::now();
+  auto lock = std::unique_lock<std::mutex>(bucketsMu);
+
+  auto& bucket = buckets[format];
+
+  if (now - bucket.window >= std::chrono::seconds(1)) {
+    bucket.window = now;
+    bucket.count  = 0;
+  }
+
+  if (bucket.count >= rateLimit) {
+    ++bucket.suppressed;
+    return false;
+  }
+
+  ++bucket.count;
+
+  suppressed = bucket.suppressed;
+  bucket.suppressed = 0;
+
+  return true;
+}
+
+void Logger::write(LogLevel l, const std::string& msg, std::uint64_t suppressed) {
+  auto text = fmt::format("{}[{}] {}", levelPrefix(l), name, msg);
+
+  if (suppressed) {
+    text += fmt::format(" ({} similar messages suppressed)", suppressed);
+  }
+
+  writer().Push(l, std::move(text));
+}
+
+} // namespace dnp3
+} // namespace otsim
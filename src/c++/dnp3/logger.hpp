@@ -0,0 +1,111 @@
+#ifndef OTSIM_DNP3_LOGGER_HPP
+#define OTSIM_DNP3_LOGGER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "fmt/format.h"
+
+namespace otsim {
+namespace dnp3 {
+
+enum class LogLevel : std::uint8_t { Debug, Info, Warn, Error };
+
+// Parses "debug", "info", "warn" or "error". Throws std::invalid_argument for
+// anything else.
+LogLevel ParseLogLevel(const std::string& name);
+
+// Logger writes leveled messages prefixed with the name of the component
+// logging them. Messages below the logger's level are discarded before being
+// formatted. Enabled messages are formatted on the calling thread and handed
+// off to a single background writer through a lock-free queue, so callers
+// never block on console I/O. If the writer falls behind, messages are
+// dropped (and counted) rather than blocking.
+//
+// Each distinct format string is rate limited separately, so a message logged
+// for every point on every update can't drown out everything else. Messages
+// over the limit are suppressed and a count of them is logged once the next
+// one is allowed through.
+class Logger {
+public:
+  Logger(const std::string& name, LogLevel level = LogLevel::Info) : name(name), level(level) {}
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  // Not thread-safe; only meant to be called during configuration.
+  void SetName(const std::string& n) { name = n; }
+
+  // Zero disables rate limiting. Not thread-safe; only meant to be called
+  // during configuration.
+  void SetRateLimit(std::uint32_t perSecond) { rateLimit = perSecond; }
+
+  void SetLevel(LogLevel l) { level.store(l, std::memory_order_relaxed); }
+
+  bool Enabled(LogLevel l) const { return l >= level.load(std::memory_order_relaxed); }
+
+  // The format string must be a string literal (or otherwise outlive the
+  // logger), since its address identifies the message for rate limiting.
+  template <typename... Args>
+  void Debug(const char* format, const Args&... args) { log(LogLevel::Debug, format, args...); }
+
+  template <typename... Args>
+  void Info(const char* format, const Args&... args) { log(LogLevel::Info, format, args...); }
+
+  template <typename... Args>
+  void Warn(const char* format, const Args&... args) { log(LogLevel::Warn, format, args...); }
+
+  template <typename... Args>
+  void Error(const char* format, const Args&... args) { log(LogLevel::Error, format, args...); }
+
+  // Number of messages dropped across all loggers because the writer fell
+  // behind.
+  static std::uint64_t Dropped();
+
+private:
+  template <typename... Args>
+  void log(LogLevel l, const char* format, const Args&... args) {
+    if (!Enabled(l)) {
+      return;
+    }
+
+    std::uint64_t suppressed = 0;
+
+    if (!allow(format, suppressed)) {
+      return;
+    }
+
+    write(l, fmt::vformat(format, fmt::make_format_args(args...)), suppressed);
+  }
+
+  // Returns false if the message should be suppressed. Otherwise, suppressed
+  // is set to the number of messages with the same format string suppressed
+  // since the last one was allowed.
+  bool allow(const char* format, std::uint64_t& suppressed);
+
+  void write(LogLevel l, const std::string& msg, std::uint64_t suppressed);
+
+  struct Bucket {
+    std::chrono::steady_clock::time_point window;
+
+    std::uint32_t count      {};
+    std::uint64_t suppressed {};
+  };
+
+  std::string name;
+  std::atomic<LogLevel> level;
+
+  std::uint32_t rateLimit = 100;
+
+  std::unordered_map<const char*, Bucket> buckets;
+  std::mutex bucketsMu;
+};
+
+} // namespace dnp3
+} // namespace otsim
+
+#endif // OTSIM_DNP3_LOGGER_HPP
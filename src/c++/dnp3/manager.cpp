@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "fmt/format.h"
+
+#include "logger.hpp"
+#include "manager.hpp"
+
+#include "msgbus/scheduler.hpp"
+
+#include "opendnp3/ConsoleLogger.h"
+
+namespace otsim {
+namespace dnp3 {
+
+namespace {
+
+Logger logger {"dnp3-manager"};
+
+std::mutex managerMu;
+ManagerConfig managerConfig;
+std::shared_ptr<opendnp3::DNP3Manager> manager;
+
+// CPU time clocks of the running manager threads, keyed by thread ID. Uses its
+// own mutex since threads start while the manager is being created.
+std::mutex clocksMu;
+std::map<std::uint32_t, clockid_t> clocks;
+
+// Protects everything below, which is only used for publishing metrics.
+std::mutex samplerMu;
+otsim::msgbus::Scheduler::TaskID sampler {};
+MetricsPusher metrics;
+std::vector<otsim::msgbus::MetricHandle> utilization;
+
+std::map<std::uint32_t, std::chrono::nanoseconds> lastUsed;
+std::chrono::steady_clock::time_point lastSampled;
+
+void onThreadStart(std::uint32_t id) {
+  if (!managerConfig.affinity.empty()) {
+    auto cpu = managerConfig.affinity[id % managerConfig.affinity.size()];
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      logger.Error("unable to pin thread {} to CPU {}", id, cpu);
+    }
+  }
+
+  clockid_t clock;
+
+  if (pthread_getcpuclockid(pthread_self(), &clock) == 0) {
+    auto lock = std::unique_lock<std::mutex>(clocksMu);
+    clocks[id] = clock;
+  }
+}
+
+void onThreadExit(std::uint32_t id) {
+  auto lock = std::unique_lock<std::mutex>(clocksMu);
+  clocks.erase(id);
+}
+
+std::chrono::nanoseconds cpuTime(clockid_t clock) {
+  timespec ts;
+
+  if (clock_gettime(clock, &ts) != 0) {
+    return std::chrono::nanoseconds(0);
+  }
+
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+void sample() {
+  auto lock = std::unique_lock<std::mutex>(samplerMu);
+
+  if (!metrics) {
+    return; // stopping
+  }
+
+  auto now     = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastSampled);
+
+  lastSampled = now;
+
+  auto clocksLock = std::unique_lock<std::mutex>(clocksMu);
+
+  for (const auto& [id, clock] : clocks) {
+    auto used = cpuTime(clock);
+
+    if (lastUsed.count(id) && elapsed.count() > 0 && id < utilization.size()) {
+      auto util = static_cast<double>((used - lastUsed[id]).count()) / elapsed.count();
+      utilization[id].Set(util);
+    }
+
+    lastUsed[id] = used;
+  }
+}
+
+} // namespace
+
+std::vector<int> ParseCPUList(const std::string& list) {
+  std::vector<int> cpus;
+
+  std::size_t pos = 0;
+
+  while (pos < list.size()) {
+    auto end = list.find(',', pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    auto item = list.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (item.empty()) {
+      continue;
+    }
+
+    try {
+      auto dash = item.find('-');
+
+      if (dash == std::string::npos) {
+        cpus.push_back(std::stoi(item));
+      } else {
+        auto first = std::stoi(item.substr(0, dash));
+        auto last  = std::stoi(item.substr(dash + 1));
+
+        if (first > last) {
+          throw std::invalid_argument(item);
+        }
+
+        for (auto cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      }
+    } catch (const std::logic_error&) {
+      throw std::invalid_argument(fmt::format("invalid CPU list {}", list));
+    }
+  }
+
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      throw std::invalid_argument(fmt::format("invalid CPU {} in CPU list {}", cpu, list));
+    }
+  }
+
+  return cpus;
+}
+
+bool ConfigureManager(ManagerConfig config) {
+  auto lock = std::unique_lock<std::mutex>(managerMu);
+
+  if (manager) {
+    return false;
+  }
+
+  managerConfig = config;
+  return true;
+}
+
+std::shared_ptr<opendnp3::DNP3Manager> SharedManager() {
+  auto lock = std::unique_lock<std::mutex>(managerMu);
+
+  if (!manager) {
+    if (managerConfig.threads == 0) {
+      managerConfig.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    logger.Info("creating DNP3 manager with {} threads", managerConfig.threads);
+
+    manager = std::make_shared<opendnp3::DNP3Manager>(
+      managerConfig.threads,
+      opendnp3::ConsoleLogger::Create(),
+      onThreadStart,
+      onThreadExit
+    );
+  }
+
+  return manager;
+}
+
+void ShutdownManager() {
+  auto lock = std::unique_lock<std::mutex>(managerMu);
+
+  if (!manager) {
+    return;
+  }
+
+  logger.Info("shutting down DNP3 manager");
+
+  // Joins the manager threads, so none are left to run onThreadExit once
+  // clocks has been destroyed.
+  manager->Shutdown();
+  manager.reset();
+}
+
+void StartManagerMetrics(Pusher pusher, const std::string& name) {
+  auto threads = SharedManager() ? managerConfig.threads : 0;
+
+  auto lock = std::unique_lock<std::mutex>(samplerMu);
+
+  if (metrics) {
+    return;
+  }
+
+  metrics = otsim::msgbus::MetricsPusher::Create();
+
+  metrics->NewMetric("Gauge", "threads", "number of DNP3 manager threads").Set(threads);
+
+  utilization.clear();
+
+  for (std::uint32_t i = 0; i < threads; ++i) {
+    utilization.push_back(metrics->NewMetric("Gauge", fmt::format("thread_{}_utilization", i), fmt::format("CPU utilization of DNP3 manager thread {}", i)));
+  }
+
+  metrics->Start(pusher, name);
+
+  lastSampled = std::chrono::steady_clock::now();
+  sampler     = otsim::msgbus::SharedScheduler().Every(std::chrono::seconds(5), sample);
+}
+
+void StopManagerMetrics() {
+  MetricsPusher stopped;
+
+  {
+    auto lock = std::unique_lock<std::mutex>(samplerMu);
+
+    if (!metrics) {
+      return;
+    }
+
+    stopped.swap(metrics);
+  }
+
+  // Not holding the lock, since canceling waits for a running sample to
+  // complete, and sampling acquires the lock.
+  otsim::msgbus::SharedScheduler().Cancel(sampler);
+  stopped->Stop();
+}
+
+} // namespace dnp3
+} // namespace otsim
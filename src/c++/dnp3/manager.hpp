@@ -0,0 +1,52 @@
+#ifndef OTSIM_DNP3_MANAGER_HPP
+#define OTSIM_DNP3_MANAGER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+#include "opendnp3/DNP3Manager.h"
+
+namespace otsim {
+namespace dnp3 {
+
+struct ManagerConfig {
+  // Number of ASIO threads shared by every DNP3 channel in the process. Zero
+  // means one per hardware thread.
+  std::uint32_t threads {};
+
+  // CPUs to pin ASIO threads to, assigned round-robin. Empty means threads are
+  // not pinned.
+  std::vector<int> affinity {};
+};
+
+// Parses a Linux style CPU list (e.g. "0-3,8,10-11"). Throws
+// std::invalid_argument if the list is malformed.
+std::vector<int> ParseCPUList(const std::string& list);
+
+// Sets the configuration used to create the DNP3 manager shared by every Server
+// and Client in the process. Returns false if the manager has already been
+// created, in which case the configuration is ignored.
+bool ConfigureManager(ManagerConfig config);
+
+// Returns the DNP3 manager shared by every Server and Client in the process,
+// creating it the first time it's called.
+std::shared_ptr<opendnp3::DNP3Manager> SharedManager();
+
+// Shuts down the shared DNP3 manager, stopping its threads and every channel
+// using it. Must be called before returning from main, since the manager's
+// threads use state that doesn't outlive static destruction.
+void ShutdownManager();
+
+// Periodically publishes the CPU utilization of each shared manager thread as
+// gauge metrics named thread_<N>_utilization (0.0 - 1.0).
+void StartManagerMetrics(Pusher pusher, const std::string& name);
+void StopManagerMetrics();
+
+} // namespace dnp3
+} // namespace otsim
+
+#endif // OTSIM_DNP3_MANAGER_HPP
@@ -1,13 +1,56 @@
-#include <iostream>
+#include <cmath>
+#include <set>
 
 #include "master.hpp"
 
 #include "fmt/format.h"
 
+#include "msgbus/trace.hpp"
+
+#include "opendnp3/master/ITaskCallback.h"
+#include "opendnp3/master/TaskConfig.h"
+
 namespace otsim {
 namespace dnp3 {
 
-Master::Master(std::string id, Pusher pusher) : id(id), pusher(pusher) {}
+// Satisfies the result of a task once opendnp3 reports it complete.
+class TaskCallback : public opendnp3::ITaskCallback {
+public:
+  TaskCallback(std::shared_ptr<AsyncResult<opendnp3::TaskCompletion>> result) : result(result) {}
+
+  // BEGIN ITaskCallback Implementation
+  void OnStart() override {}
+  void OnComplete(opendnp3::TaskCompletion res) override { result->Set(res); }
+  // Only has an effect if the task was never completed, such as when the
+  // master is shut down with the task still queued.
+  void OnDestroyed() override { result->Set(opendnp3::TaskCompletion::FAILURE_NO_COMMS); }
+  // END ITaskCallback Implementation
+
+private:
+  std::shared_ptr<AsyncResult<opendnp3::TaskCompletion>> result;
+};
+
+Master::Master(std::string id, Pusher pusher) : id(id), pusher(pusher), logger(id) {
+  metrics = otsim::msgbus::MetricsPusher::Create();
+
+  commandCount      = metrics->NewMetric("Counter", "dnp3_command_count",       "number of DNP3 command requests issued");
+  commandErrorCount = metrics->NewMetric("Counter", "dnp3_command_error_count", "number of tags DNP3 command requests failed to write");
+  commandsInFlight  = metrics->NewMetric("Gauge",   "dnp3_commands_in_flight",  "number of DNP3 command requests awaiting a result");
+  confirmationCount = metrics->NewMetric("Counter", "confirmation_count",       "number of OT-sim confirmation messages generated");
+  suppressedCount   = metrics->NewMetric("Counter", "dnp3_suppressed_count",    "number of unchanged DNP3 point values not published");
+
+  commandLatency = metrics->NewHistogram("dnp3_command_latency_seconds", "round trip time of DNP3 command requests");
+}
+
+bool Master::Enable() {
+  metrics->Start(pusher, id);
+  return master->Enable();
+}
+
+bool Master::Disable() {
+  metrics->Stop();
+  return master->Disable();
+}
 
 void Master::HandleMsgBusUpdate(const otsim::msgbus::Envelope<otsim::msgbus::Update>& env) {
   auto sender = otsim::msgbus::GetEnvelopeSender(env);
@@ -16,35 +59,316 @@ void Master::HandleMsgBusUpdate(const otsim::msgbus::Envelope<otsim::msgbus::Upd
     return;
   }
 
-  for (auto &p : env.contents.updates) {
-    if (WriteBinary(p.tag, p.value)) {
+  auto confirmation = std::make_shared<PendingConfirmation>();
+  confirmation->confirm = env.contents.confirm;
+
+  write(env.contents.updates, confirmation);
+
+  if (otsim::msgbus::Tracing()) {
+    auto received = otsim::msgbus::TraceTimestamp(env.metadata, otsim::msgbus::TRACE_RECEIVED);
+
+    if (received && env.metadata.count(otsim::msgbus::TRACE_ID)) {
+      otsim::msgbus::TraceSpan("master write", env.metadata.at(otsim::msgbus::TRACE_ID), received, otsim::msgbus::TraceNow());
+    }
+  }
+}
+
+void Master::write(const otsim::msgbus::Points& points, std::shared_ptr<PendingConfirmation> confirmation) {
+  // Group the commands for all the points being written by whether they're
+  // written using select before operate or direct operate, so each group only
+  // costs a single request to the outstation instead of one per point.
+  Commands sbo, direct;
+
+  for (auto &p : points) {
+    auto binary = binaryOutputs.find(p.tag);
+    if (binary != binaryOutputs.end()) {
+      auto& point = binary->second;
+
+      if (point.output) {
+        opendnp3::OperationType code = p.value ? opendnp3::OperationType::LATCH_ON : opendnp3::OperationType::LATCH_OFF;
+        (point.sbo ? sbo : direct).binaries.push_back({opendnp3::ControlRelayOutputBlock(code), point.address, p.tag});
+      }
+
       continue;
     }
 
-    WriteAnalog(p.tag, p.value);
+    auto analog = analogOutputs.find(p.tag);
+    if (analog != analogOutputs.end()) {
+      auto& point = analog->second;
+
+      // TODO: use point group and variation to determine which type of analog
+      // value to write.
+
+      if (point.output) {
+        (point.sbo ? sbo : direct).analogs.push_back({opendnp3::AnalogOutputFloat32(p.value), point.address, p.tag});
+      }
+    }
+  }
+
+  // Counted up front, since the first request can complete before the second
+  // one is issued.
+  for (auto commands : {&sbo, &direct}) {
+    if (!commands->binaries.empty() || !commands->analogs.empty()) {
+      ++confirmation->requests;
+    }
+  }
+
+  if (!confirmation->requests) {
+    if (confirmation->result) {
+      confirmation->result->Set(confirmation->errors);
+    }
+
+    return;
+  }
+
+  operate(sbo, true, confirmation);
+  operate(direct, false, confirmation);
+}
+
+bool Master::WriteBinary(std::string tag, bool status) {
+  auto iter = binaryOutputs.find(tag);
+  if (iter == binaryOutputs.end() || !iter->second.output) {
+    return false;
+  }
+
+  write({otsim::msgbus::Point{tag, status ? 1.0 : 0.0}}, std::make_shared<PendingConfirmation>());
+  return true;
+}
+
+bool Master::WriteAnalog(std::string tag, double value) {
+  auto iter = analogOutputs.find(tag);
+  if (iter == analogOutputs.end() || !iter->second.output) {
+    return false;
+  }
+
+  write({otsim::msgbus::Point{tag, value}}, std::make_shared<PendingConfirmation>());
+  return true;
+}
+
+std::future<opendnp3::RestartOperationResult> Master::RestartAsync(opendnp3::RestartType type, std::chrono::milliseconds timeout) {
+  auto result = AsyncResult<opendnp3::RestartOperationResult>::Create(timeout,
+    opendnp3::RestartOperationResult(opendnp3::TaskCompletion::FAILURE_RESPONSE_TIMEOUT, opendnp3::TimeDuration()),
+    opendnp3::RestartOperationResult(opendnp3::TaskCompletion::FAILURE_NO_COMMS, opendnp3::TimeDuration()));
+
+  auto future = result->Future();
+
+  master->Restart(type, [result](const opendnp3::RestartOperationResult& res) -> void {
+    result->Set(res);
+  });
+
+  return future;
+}
+
+std::future<otsim::msgbus::ConfirmationErrors> Master::WriteAsync(const otsim::msgbus::Points& points, std::chrono::milliseconds timeout) {
+  auto confirmation = std::make_shared<PendingConfirmation>();
+  otsim::msgbus::ConfirmationErrors timedOut, abandoned;
+
+  // Unlike Updates from the message bus, which are meant for whichever master
+  // has the tag, every point written here is expected to be an output of this
+  // master.
+  for (auto& p : points) {
+    auto binary = binaryOutputs.find(p.tag);
+    auto analog = analogOutputs.find(p.tag);
+
+    if ((binary != binaryOutputs.end() && binary->second.output) || (analog != analogOutputs.end() && analog->second.output)) {
+      timedOut[p.tag]  = "timed out waiting for command result";
+      abandoned[p.tag] = "no command result received";
+    } else {
+      confirmation->errors[p.tag] = "not an output of this master";
+    }
   }
+
+  timedOut.insert(confirmation->errors.begin(), confirmation->errors.end());
+  abandoned.insert(confirmation->errors.begin(), confirmation->errors.end());
+
+  confirmation->result = AsyncResult<otsim::msgbus::ConfirmationErrors>::Create(timeout, timedOut, abandoned);
+
+  auto future = confirmation->result->Future();
+  write(points, confirmation);
+
+  return future;
+}
+
+std::future<opendnp3::TaskCompletion> Master::ScanAsync(const opendnp3::ClassField& field, std::chrono::milliseconds timeout) {
+  auto result = AsyncResult<opendnp3::TaskCompletion>::Create(timeout,
+    opendnp3::TaskCompletion::FAILURE_RESPONSE_TIMEOUT, opendnp3::TaskCompletion::FAILURE_NO_COMMS);
+  auto future = result->Future();
+
+  master->ScanClasses(field, shared_from_this(), opendnp3::TaskConfig::With(std::make_shared<TaskCallback>(result)));
+
+  return future;
+}
+
+void Master::operate(const Commands& commands, bool sbo, std::shared_ptr<PendingConfirmation> confirmation) {
+  if (commands.binaries.empty() && commands.analogs.empty()) {
+    return;
+  }
+
+  // Each object type gets its own header in the request.
+  opendnp3::CommandSet set;
+
+  if (!commands.binaries.empty()) {
+    auto& header = set.StartHeader<opendnp3::ControlRelayOutputBlock>();
+
+    for (auto& cmd : commands.binaries) {
+      header.Add(cmd.value, cmd.address);
+    }
+  }
+
+  if (!commands.analogs.empty()) {
+    auto& header = set.StartHeader<opendnp3::AnalogOutputFloat32>();
+
+    for (auto& cmd : commands.analogs) {
+      header.Add(cmd.value, cmd.address);
+    }
+  }
+
+  logger.Debug("issuing {} binary and {} analog commands using {}", commands.binaries.size(), commands.analogs.size(), sbo ? "select before operate" : "direct operate");
+
+  auto start = std::chrono::steady_clock::now();
+  auto self  = weak_from_this();
+
+  auto callback = [self, commands, start, confirmation](const opendnp3::ICommandTaskResult& result) -> void {
+    if (auto master = self.lock()) {
+      master->complete(commands, result, std::chrono::steady_clock::now() - start, confirmation);
+      return;
+    }
+
+    // Nothing is left to publish a confirmation once the master is gone, but
+    // a WriteAsync caller may still be waiting on the result.
+    auto lock = std::unique_lock<std::mutex>(confirmation->mu);
+
+    for (auto& cmd : commands.binaries) {
+      confirmation->errors[cmd.tag] = "master shut down";
+    }
+
+    for (auto& cmd : commands.analogs) {
+      confirmation->errors[cmd.tag] = "master shut down";
+    }
+
+    if (--confirmation->requests == 0 && confirmation->result) {
+      confirmation->result->Set(confirmation->errors);
+    }
+  };
+
+  commandCount.Incr();
+  commandsInFlight.Incr();
+
+  if (sbo) {
+    master->SelectAndOperate(std::move(set), callback);
+  } else {
+    master->DirectOperate(std::move(set), callback);
+  }
+}
+
+void Master::complete(const Commands& commands, const opendnp3::ICommandTaskResult& result, std::chrono::steady_clock::duration latency, std::shared_ptr<PendingConfirmation> confirmation) {
+  commandsInFlight.Incr(-1);
+  commandLatency.Observe(latency);
+
+  // Tags written by each point in the request, keyed by the index of its
+  // header and its address, which is how opendnp3 reports point results.
+  std::map<std::pair<std::uint32_t, std::uint16_t>, std::string> tags;
+  std::uint32_t header = 0;
+
+  if (!commands.binaries.empty()) {
+    for (auto& cmd : commands.binaries) {
+      tags[{header, cmd.address}] = cmd.tag;
+    }
+
+    ++header;
+  }
+
+  for (auto& cmd : commands.analogs) {
+    tags[{header, cmd.address}] = cmd.tag;
+  }
+
+  otsim::msgbus::ConfirmationErrors errors;
+  std::set<std::string> succeeded;
+
+  result.ForeachItem([&](const opendnp3::CommandPointResult& point) {
+    auto iter = tags.find({point.headerIndex, point.index});
+    if (iter == tags.end()) {
+      return;
+    }
+
+    if (point.state == opendnp3::CommandPointState::SUCCESS && point.status == opendnp3::CommandStatus::SUCCESS) {
+      succeeded.insert(iter->second);
+    } else {
+      errors[iter->second] = fmt::format("{} ({})",
+        opendnp3::CommandPointStateSpec::to_human_string(point.state), opendnp3::CommandStatusSpec::to_human_string(point.status));
+    }
+  });
+
+  // Points the outstation never got to respond to, such as when the request
+  // times out, failed with the request as a whole.
+  if (result.summary != opendnp3::TaskCompletion::SUCCESS) {
+    for (auto& kv : tags) {
+      if (!succeeded.count(kv.second) && !errors.count(kv.second)) {
+        errors[kv.second] = opendnp3::TaskCompletionSpec::to_human_string(result.summary);
+      }
+    }
+  }
+
+  for (auto& [tag, err] : errors) {
+    logger.Error("writing tag {} failed: {}", tag, err);
+  }
+
+  commandErrorCount.Incr(errors.size());
+
+  otsim::msgbus::Confirmation contents;
+
+  {
+    auto lock = std::unique_lock<std::mutex>(confirmation->mu);
+
+    confirmation->errors.insert(errors.begin(), errors.end());
+
+    if (--confirmation->requests > 0) {
+      return;
+    }
+
+    if (confirmation->result) {
+      confirmation->result->Set(confirmation->errors);
+    }
+
+    if (confirmation->confirm.empty()) {
+      return;
+    }
+
+    contents = {.confirm = confirmation->confirm, .errors = confirmation->errors};
+  }
+
+  auto env = otsim::msgbus::NewEnvelope(id, contents);
+
+  pusher->Push("RUNTIME", env);
+  confirmationCount.Incr();
+}
+
+void Master::BeginFragment(const opendnp3::ResponseInfo& info) {
+  batch.clear();
+
+  if (otsim::msgbus::Tracing()) {
+    batchStart = otsim::msgbus::TraceNow();
+  }
+}
+
+void Master::EndFragment(const opendnp3::ResponseInfo& info) {
+  flush();
 }
 
 void Master::Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollection<opendnp3::Indexed<opendnp3::Binary>>& values) {
   values.ForeachItem([&](const opendnp3::Indexed<opendnp3::Binary>& value) {
     const char* gvar = opendnp3::GroupVariationSpec().to_string(info.gv);
 
-    std::cout << fmt::format("[{}] BOOLEAN INPUT   GV:ADDR:VALUE:TIME = {}:{}:{}:{}", id, gvar, value.index, value.value.value, value.value.time.value) << std::endl;
+    logger.Debug("BOOLEAN INPUT   GV:ADDR:VALUE:TIME = {}:{}:{}:{}", gvar, value.index, value.value.value, value.value.time.value);
 
     auto tag = GetBinaryTag(value.index);
 
     if (!tag.empty()) {
-      std::cout << fmt::format("[{}] setting tag {} to {}", id, tag, value.value.value) << std::endl;
+      logger.Debug("setting tag {} to {}", tag, value.value.value);
 
-      otsim::msgbus::Points points;
-      points.push_back(otsim::msgbus::Point{tag, value.value.value ? 1.0 : 0.0, value.value.time.value});
-
-      otsim::msgbus::Status contents = {.measurements = points};
-      auto env = otsim::msgbus::NewEnvelope(id, contents);
-
-      pusher->Push("RUNTIME", env);
+      publish(otsim::msgbus::Point{tag, value.value.value ? 1.0 : 0.0, value.value.time.value});
     } else {
-      std::cout << fmt::format("[{}] data manager in master missing tag for binary input at address {}", id, value.index) << std::endl;
+      logger.Warn("data manager in master missing tag for binary input at address {}", value.index);
     }
   });
 }
@@ -53,22 +377,16 @@ void Master::Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollecti
   values.ForeachItem([&](const opendnp3::Indexed<opendnp3::BinaryOutputStatus>& value) {
     const char* gvar = opendnp3::GroupVariationSpec().to_string(info.gv);
 
-    std::cout << fmt::format("[{}] BOOLEAN OUTPUT  GV:ADDR:VALUE:TIME = {}:{}:{}:{}", id, gvar, value.index, value.value.value, value.value.time.value) << std::endl;
+    logger.Debug("BOOLEAN OUTPUT  GV:ADDR:VALUE:TIME = {}:{}:{}:{}", gvar, value.index, value.value.value, value.value.time.value);
 
     auto tag = GetBinaryTag(value.index, true);
 
     if (!tag.empty()) {
-      std::cout << fmt::format("[{}] setting tag {} to {}", id, tag, value.value.value) << std::endl;
-
-      otsim::msgbus::Points points;
-      points.push_back(otsim::msgbus::Point{tag, value.value.value ? 1.0 : 0.0, value.value.time.value});
+      logger.Debug("setting tag {} to {}", tag, value.value.value);
 
-      otsim::msgbus::Status contents = {.measurements = points};
-      auto env = otsim::msgbus::NewEnvelope(id, contents);
-
-      pusher->Push("RUNTIME", env);
+      publish(otsim::msgbus::Point{tag, value.value.value ? 1.0 : 0.0, value.value.time.value});
     } else {
-      std::cout << fmt::format("[{}] data manager in master missing tag for binary output at address {}", id, value.index) << std::endl;
+      logger.Warn("data manager in master missing tag for binary output at address {}", value.index);
     }
   });
 }
@@ -77,22 +395,16 @@ void Master::Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollecti
   values.ForeachItem([&](const opendnp3::Indexed<opendnp3::Analog>& value) {
     const char* gvar = opendnp3::GroupVariationSpec().to_string(info.gv);
 
-    std::cout << fmt::format("[{}] ANALOG INPUT    GV:ADDR:VALUE:TIME = {}:{}:{}:{}", id, gvar, value.index, value.value.value, value.value.time.value) << std::endl;
+    logger.Debug("ANALOG INPUT    GV:ADDR:VALUE:TIME = {}:{}:{}:{}", gvar, value.index, value.value.value, value.value.time.value);
 
     auto tag = GetAnalogTag(value.index);
 
     if (!tag.empty()) {
-      std::cout << fmt::format("[{}] setting tag {} to {}", id, tag, value.value.value) << std::endl;
-
-      otsim::msgbus::Points points;
-      points.push_back(otsim::msgbus::Point{tag, value.value.value, value.value.time.value});
-
-      otsim::msgbus::Status contents = {.measurements = points};
-      auto env = otsim::msgbus::NewEnvelope(id, contents);
+      logger.Debug("setting tag {} to {}", tag, value.value.value);
 
-      pusher->Push("RUNTIME", env);
+      publish(otsim::msgbus::Point{tag, value.value.value, value.value.time.value});
     } else {
-      std::cout << fmt::format("[{}] data manager in master missing tag for analog input at address {}", id, value.index) << std::endl;
+      logger.Warn("data manager in master missing tag for analog input at address {}", value.index);
     }
   });
 }
@@ -101,25 +413,94 @@ void Master::Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollecti
   values.ForeachItem([&](const opendnp3::Indexed<opendnp3::AnalogOutputStatus>& value) {
     const char* gvar = opendnp3::GroupVariationSpec().to_string(info.gv);
 
-    std::cout << fmt::format("[{}] ANALOG OUTPUT   GV:ADDR:VALUE:TIME = {}:{}:{}:{}", id, gvar, value.index, value.value.value, value.value.time.value) << std::endl;
+    logger.Debug("ANALOG OUTPUT   GV:ADDR:VALUE:TIME = {}:{}:{}:{}", gvar, value.index, value.value.value, value.value.time.value);
 
     auto tag = GetAnalogTag(value.index, true);
 
     if (!tag.empty()) {
-      std::cout << fmt::format("[{}] setting tag {} to {}", id, tag, value.value.value) << std::endl;
+      logger.Debug("setting tag {} to {}", tag, value.value.value);
 
-      otsim::msgbus::Points points;
-      points.push_back(otsim::msgbus::Point{tag, value.value.value, value.value.time.value});
-
-      otsim::msgbus::Status contents = {.measurements = points};
-      auto env = otsim::msgbus::NewEnvelope(id, contents);
-
-      pusher->Push("RUNTIME", env);
+      publish(otsim::msgbus::Point{tag, value.value.value, value.value.time.value});
     } else {
-      std::cout << fmt::format("[{}] data manager in master missing tag for analog output at address {}", id, value.index) << std::endl;
+      logger.Warn("data manager in master missing tag for analog output at address {}", value.index);
     }
   });
 }
 
+void Master::publish(const otsim::msgbus::Point& point) {
+  if (reportByException && !changed(point)) {
+    suppressedCount.Incr();
+    return;
+  }
+
+  batch.push_back(point);
+
+  if (maxBatchSize && batch.size() >= maxBatchSize) {
+    flush();
+  }
+}
+
+bool Master::changed(const otsim::msgbus::Point& point) {
+  auto now  = std::chrono::steady_clock::now();
+  auto iter = lastValues.find(point.tag);
+
+  if (iter == lastValues.end()) {
+    lastValues[point.tag] = {point.value, now};
+    return true;
+  }
+
+  auto& last = iter->second;
+
+  double deadband = 0.0;
+
+  auto db = deadbands.find(point.tag);
+  if (db != deadbands.end()) {
+    deadband = db->second;
+  }
+
+  // Compared against the last value published rather than the last value
+  // received, so slow drift within the deadband still gets published
+  // eventually. Any difference is NaN if either value is, so going to or from
+  // NaN is checked for separately.
+  bool publish = std::isnan(point.value) != std::isnan(last.value) || std::abs(point.value - last.value) > deadband;
+
+  if (!publish && maxSilence.count() > 0) {
+    publish = now - last.published >= maxSilence;
+  }
+
+  if (publish) {
+    last = {point.value, now};
+  }
+
+  return publish;
+}
+
+void Master::flush() {
+  if (batch.empty()) {
+    return;
+  }
+
+  otsim::msgbus::Status contents = {.measurements = batch};
+  auto env = otsim::msgbus::NewEnvelope(id, contents);
+
+  if (otsim::msgbus::Tracing()) {
+    auto now     = otsim::msgbus::TraceNow();
+    auto traceID = otsim::msgbus::NewTraceID(id);
+
+    // Pusher::Push only assigns a trace ID if the envelope doesn't already
+    // have one, so this ties the fragment span to the published status.
+    env.metadata[otsim::msgbus::TRACE_ID] = traceID;
+
+    otsim::msgbus::TraceSpan("master fragment", traceID, batchStart ? batchStart : now, now);
+
+    // Any further points in this fragment go in the next batch.
+    batchStart = now;
+  }
+
+  pusher->Push("RUNTIME", env);
+
+  batch.clear();
+}
+
 } // namespace dnp3
 } // namespace otsim
@@ -1,15 +1,21 @@
 #ifndef OTSIM_DNP3_MASTER_HPP
 #define OTSIM_DNP3_MASTER_HPP
 
-#include <condition_variable>
-#include <iostream>
+#include <chrono>
+#include <future>
 #include <map>
+#include <mutex>
+#include <unordered_map>
 
+#include "async.hpp"
 #include "common.hpp"
+#include "logger.hpp"
 
 #include "msgbus/envelope.hpp"
+#include "msgbus/metrics.hpp"
 
 #include "opendnp3/master/CommandSet.h"
+#include "opendnp3/master/ICommandTaskResult.h"
 #include "opendnp3/master/IMaster.h"
 #include "opendnp3/master/ISOEHandler.h"
 #include "opendnp3/master/MasterStackConfig.h"
@@ -33,29 +39,59 @@ public:
 
   void SetIMaster(std::shared_ptr<opendnp3::IMaster> m) { master = m; }
 
-  bool Enable() { return master->Enable(); }
-  bool Disable() { return master->Disable(); }
+  bool Enable();
+  bool Disable();
+
+  // Limit the number of points published in a single Status envelope. Points
+  // received in a response fragment are otherwise published together in one
+  // envelope when the fragment ends. Zero means no limit.
+  void SetMaxBatchSize(std::size_t size) { maxBatchSize = size; }
+
+  // Only publish points whose value has changed since it was last published
+  // (by more than the point's deadband, for analogs), instead of every value
+  // returned by every scan. Unchanged values are still republished once they
+  // haven't been published for maxSilence, unless it's zero.
+  void SetReportByException(bool enabled, std::chrono::seconds maxSilence = {}) {
+    reportByException = enabled;
+    this->maxSilence  = maxSilence;
+  }
+
+  // Sets the deadband used for the given analog tag when reporting by
+  // exception.
+  void SetDeadband(const std::string& tag, double deadband) { deadbands[tag] = deadband; }
+
+  void SetLogLevel(LogLevel level) { logger.SetLevel(level); }
+  void SetLogRateLimit(std::uint32_t perSecond) { logger.SetRateLimit(perSecond); }
 
   void AddClassScan(const opendnp3::ClassField& field, opendnp3::TimeDuration period) {
     master->AddClassScan(field, period, shared_from_this());
   }
 
+  // Blocks until the outstation responds to the restart (or opendnp3 gives up
+  // on it), returning the restart time it reported in milliseconds.
   std::int64_t Restart(opendnp3::RestartType type) {
-    std::condition_variable wait;
-    std::int64_t duration;
+    auto res = RestartAsync(type).get();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(res.restartTime.value).count();
+  }
 
-    auto callback = [&](opendnp3::RestartOperationResult res) -> void {
-      duration = std::chrono::duration_cast<std::chrono::milliseconds>(res.restartTime.value).count();
-      wait.notify_all();
-    };
+  // The asynchronous operations below return futures that are always
+  // satisfied, so many masters can be driven from a single thread. A zero
+  // timeout leaves it to opendnp3's response timeout to fail the operation;
+  // otherwise the future is satisfied with a failure after timeout even if
+  // opendnp3 is still waiting on the outstation.
 
-    master->Restart(type, callback);
+  // Restarts the outstation. Timeouts are reported as FAILURE_RESPONSE_TIMEOUT.
+  std::future<opendnp3::RestartOperationResult> RestartAsync(opendnp3::RestartType type, std::chrono::milliseconds timeout = {});
 
-    std::mutex m; std::unique_lock<std::mutex> lock(m);
-    wait.wait(lock);
+  // Writes the given points to the outstation in as few requests as possible,
+  // the same as an Update received from the message bus. The result holds an
+  // error for each point that failed to be written, keyed by tag, and is empty
+  // on success.
+  std::future<otsim::msgbus::ConfirmationErrors> WriteAsync(const otsim::msgbus::Points& points, std::chrono::milliseconds timeout = {});
 
-    return duration;
-  }
+  // Demands a scan of the given classes, publishing the points returned the
+  // same as a periodic class scan.
+  std::future<opendnp3::TaskCompletion> ScanAsync(const opendnp3::ClassField& field, std::chrono::milliseconds timeout = {});
 
   opendnp3::MasterStackConfig BuildConfig(std::uint16_t local, std::uint16_t remote, std::int64_t timeout) {
     address = local;
@@ -71,7 +107,7 @@ public:
     config.link.LocalAddr  = local;
     config.link.RemoteAddr = remote;
 
-    std::cout << "initializing master " << config.link.LocalAddr << " --> " << config.link.RemoteAddr << std::endl;
+    logger.Info("initializing master {} --> {}", config.link.LocalAddr, config.link.RemoteAddr);
 
     return config;
   }
@@ -134,62 +170,11 @@ public:
     return {};
   }
 
-  bool WriteBinary(std::string tag, bool status) {
-    auto iter = binaryOutputs.find(tag);
-    if (iter == binaryOutputs.end()) {
-      return false;
-    }
-
-    auto point = iter->second;
-
-    if (!point.output) {
-      return false;
-    }
-
-    auto callback = [](const opendnp3::ICommandTaskResult&) -> void {};
-
-    if (point.sbo) {
-      opendnp3::OperationType code = status ? opendnp3::OperationType::LATCH_ON : opendnp3::OperationType::LATCH_OFF;
-      opendnp3::ControlRelayOutputBlock crob(code);
-
-      master->SelectAndOperate(opendnp3::CommandSet({ WithIndex(crob, point.address) }), callback);
-    } else {
-      opendnp3::OperationType code = status ? opendnp3::OperationType::LATCH_ON : opendnp3::OperationType::LATCH_OFF;
-      opendnp3::ControlRelayOutputBlock crob(code);
-
-      master->DirectOperate(opendnp3::CommandSet({ WithIndex(crob, point.address) }), callback);
-    }
-
-    return true;
-  }
-
-  bool WriteAnalog(std::string tag, double value) {
-    auto iter = analogOutputs.find(tag);
-    if (iter == analogOutputs.end()) {
-      return false;
-    }
-
-    auto point = iter->second;
-
-    if (!point.output) {
-      return false;
-    }
-
-    auto callback = [](const opendnp3::ICommandTaskResult&) -> void {};
-
-    // TODO: use point group and variation to determine which type of analog
-    // value to write.
-
-    if (point.sbo) {
-      auto val = static_cast<opendnp3::AnalogOutputFloat32>(value);
-      master->SelectAndOperate(opendnp3::CommandSet({ WithIndex(val, point.address) }), callback);
-    } else {
-      auto val = static_cast<opendnp3::AnalogOutputFloat32>(value);
-      master->DirectOperate(opendnp3::CommandSet({ WithIndex(val, point.address) }), callback);
-    }
-
-    return true;
-  }
+  // Writes a single point to the outstation, returning false if the tag isn't
+  // an output of this master. Failures are logged and counted the same as for
+  // Updates; use WriteAsync to get the result.
+  bool WriteBinary(std::string tag, bool status);
+  bool WriteAnalog(std::string tag, double value);
 
   void HandleMsgBusUpdate(const otsim::msgbus::Envelope<otsim::msgbus::Update>& env);
 
@@ -208,16 +193,89 @@ public:
   virtual void Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollection<opendnp3::Indexed<opendnp3::AnalogCommandEvent>>& values) override {}
   virtual void Process(const opendnp3::HeaderInfo& info, const opendnp3::ICollection<opendnp3::DNPTime>& values) override {}
 
-  virtual void BeginFragment(const opendnp3::ResponseInfo& info) final {}
-  virtual void EndFragment(const opendnp3::ResponseInfo& info) final {}
+  virtual void BeginFragment(const opendnp3::ResponseInfo& info) override;
+  virtual void EndFragment(const opendnp3::ResponseInfo& info) override;
 
   // END ISOEHandler Implementation
 
 private:
+  template <typename T>
+  struct Command {
+    T             value;
+    std::uint16_t address;
+    std::string   tag;
+  };
+
+  // Commands to be sent to the outstation in a single request.
+  struct Commands {
+    std::vector<Command<opendnp3::ControlRelayOutputBlock>> binaries;
+    std::vector<Command<opendnp3::AnalogOutputFloat32>>     analogs;
+  };
+
+  // Collects the results of the requests issued for a single Update, so a
+  // Confirmation can be published once all of them have completed. Request
+  // callbacks run on the stack's executor, but the mutex keeps this safe
+  // regardless of where they run.
+  struct PendingConfirmation {
+    std::mutex mu;
+
+    std::string confirm;
+    std::size_t requests {};
+
+    otsim::msgbus::ConfirmationErrors errors;
+
+    // Set for writes made using WriteAsync.
+    std::shared_ptr<AsyncResult<otsim::msgbus::ConfirmationErrors>> result;
+  };
+
+  void write(const otsim::msgbus::Points& points, std::shared_ptr<PendingConfirmation> confirmation);
+  void operate(const Commands& commands, bool sbo, std::shared_ptr<PendingConfirmation> confirmation);
+  void complete(const Commands& commands, const opendnp3::ICommandTaskResult& result, std::chrono::steady_clock::duration latency, std::shared_ptr<PendingConfirmation> confirmation);
+
+  void publish(const otsim::msgbus::Point& point);
+  void flush();
+
+  // Returns true if the given point should be published when reporting by
+  // exception, recording it as the last value published if so.
+  bool changed(const otsim::msgbus::Point& point);
+
   std::string   id;
   std::uint16_t address;
 
   Pusher pusher;
+  Logger logger;
+
+  MetricsPusher metrics;
+
+  otsim::msgbus::MetricHandle    commandCount;
+  otsim::msgbus::MetricHandle    commandErrorCount;
+  otsim::msgbus::MetricHandle    commandsInFlight;
+  otsim::msgbus::MetricHandle    confirmationCount;
+  otsim::msgbus::MetricHandle    suppressedCount;
+  otsim::msgbus::HistogramHandle commandLatency;
+
+  // Points received in the current response fragment that have yet to be
+  // published. Only accessed from the stack's SOE handler callbacks, which
+  // opendnp3 executes serially for a given master.
+  otsim::msgbus::Points batch;
+  std::size_t maxBatchSize {};
+
+  // When the points in the current batch started being collected, in trace
+  // time. Only set when tracing is enabled.
+  std::uint64_t batchStart {};
+
+  struct LastValue {
+    double value;
+    std::chrono::steady_clock::time_point published;
+  };
+
+  // Last value published for each tag when reporting by exception. Like the
+  // batch, only accessed from the stack's SOE handler callbacks.
+  bool reportByException {};
+  std::chrono::seconds maxSilence {};
+
+  std::unordered_map<std::string, LastValue> lastValues;
+  std::unordered_map<std::string, double>    deadbands;
 
   std::shared_ptr<opendnp3::IMaster> master;
 
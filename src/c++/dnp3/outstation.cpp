@@ -1,24 +1,34 @@
-#include <iostream>
-
 #include "outstation.hpp"
 
 #include "fmt/format.h"
 #include "opendnp3/outstation/UpdateBuilder.h"
 
 #include "msgbus/metrics.hpp"
+#include "msgbus/trace.hpp"
 
 namespace otsim {
 namespace dnp3 {
 
 Outstation::Outstation(OutstationConfig config, OutstationRestartConfig restart, Pusher pusher) :
-  DefaultOutstationApplication(opendnp3::TimeDuration::Minutes(1)), config(config), restartConfig(restart), pusher(pusher)
+  DefaultOutstationApplication(opendnp3::TimeDuration::Minutes(1)), config(config), restartConfig(restart), pusher(pusher), logger(config.id)
 {
+  try {
+    logger.SetLevel(ParseLogLevel(config.logLevel));
+  } catch (const std::invalid_argument& e) {
+    logger.Warn("{}, defaulting to info", e.what());
+  }
+
+  logger.SetRateLimit(config.logRateLimit);
+
   metrics = otsim::msgbus::MetricsPusher::Create();
 
-  metrics->NewMetric("Counter", "status_count",            "number of OT-sim status messages processed");
-  metrics->NewMetric("Counter", "update_count",            "number of OT-sim update messages generated");
-  metrics->NewMetric("Counter", "dnp3_binary_write_count", "number of DNP3 binary writes processed");
-  metrics->NewMetric("Counter", "dnp3_analog_write_count", "number of DNP3 analog writes processed");
+  statusCount      = metrics->NewMetric("Counter", "status_count",            "number of OT-sim status messages processed");
+  updateCount      = metrics->NewMetric("Counter", "update_count",            "number of OT-sim update messages generated");
+  binaryWriteCount = metrics->NewMetric("Counter", "dnp3_binary_write_count", "number of DNP3 binary writes processed");
+  analogWriteCount = metrics->NewMetric("Counter", "dnp3_analog_write_count", "number of DNP3 analog writes processed");
+
+  applyLatency    = metrics->NewSummary("status_apply_latency_seconds", "time from receiving OT-sim status messages to applying them to the DNP3 database");
+  operateDuration = metrics->NewHistogram("dnp3_operate_duration_seconds", "time spent processing DNP3 operate commands");
 }
 
 opendnp3::OutstationStackConfig Outstation::Init() {
@@ -67,94 +77,162 @@ opendnp3::OutstationStackConfig Outstation::Init() {
   return stack;
 }
 
-void Outstation::Run() {
+void Outstation::Start() {
   metrics->Start(pusher, config.id);
 
-  while (running) {
-    if (restartConfig.coldRestart) {
-      restartConfig.coldRestarter(config.localAddr);
-      restartConfig.coldRestart.store(false);
+  auto lock = std::unique_lock<std::mutex>(pointsMu);
 
-      continue;
-    }
+  // Make sure every point gets applied at least once so the outstation
+  // database reflects initial values and point flags.
+  store.Invalidate();
+  pending = true;
+  started = true;
 
-    if (restartConfig.warmRestart) {
-      Disable();
-      std::this_thread::sleep_for(std::chrono::seconds(restartConfig.warm));
-      Enable();
+  if (config.updateMode == "poll") {
+    applyTask = otsim::msgbus::SharedScheduler().Every(std::chrono::seconds(1), [this]() {
+      {
+        auto lock = std::unique_lock<std::mutex>(pointsMu);
 
-      restartConfig.warmRestart.store(false);
-      continue;
-    }
+        store.Invalidate();
+        pending = true;
+      }
 
-    opendnp3::UpdateBuilder builder;
+      apply();
+    });
+  } else {
+    schedule();
+  }
+}
 
-    for (const auto& kv : binaryInputs) {
-      const std::uint16_t addr = kv.first;
-      const std::string   tag  = kv.second.tag;
+void Outstation::Stop() {
+  otsim::msgbus::Scheduler::TaskID apply, restart;
 
-      try {
-        auto lock = std::unique_lock<std::mutex>(pointsMu);
+  {
+    auto lock = std::unique_lock<std::mutex>(pointsMu);
 
-        auto point = points.at(tag);
-        builder.Update(opendnp3::Binary(point.value != 0), addr);
+    started = false;
 
-        std::cout << fmt::format("[{}] updated binary input {} to {}", config.id, addr, point.value) << std::endl;
-      } catch (const std::out_of_range&) {}
-    }
+    apply   = applyTask;
+    restart = restartTask;
+  }
 
-    for (const auto& kv : binaryOutputs) {
-      const std::uint16_t addr = kv.first;
-      const std::string   tag  = kv.second.tag;
+  // Not holding the lock, since canceling waits for running tasks to complete.
+  otsim::msgbus::SharedScheduler().Cancel(apply);
+  otsim::msgbus::SharedScheduler().Cancel(restart);
 
-      try {
-        auto lock = std::unique_lock<std::mutex>(pointsMu);
+  // The canceled tasks would have cleared these when they ran, so clear them
+  // here or, once started again, no apply would ever be scheduled and every
+  // restart would be ignored.
+  {
+    auto lock = std::unique_lock<std::mutex>(pointsMu);
 
-        auto point = points.at(tag);
-        builder.Update(opendnp3::BinaryOutputStatus(point.value != 0), addr);
+    scheduled = false;
 
-        std::cout << fmt::format("[{}] updated binary output {} to {}", config.id, addr, point.value) << std::endl;
-      } catch (const std::out_of_range&) {}
-    }
+    restartConfig.coldRestart.store(false);
+    restartConfig.warmRestart.store(false);
+  }
 
-    for (const auto& kv : analogInputs) {
-      const std::uint16_t addr = kv.first;
-      const std::string   tag  = kv.second.tag;
+  metrics->Stop();
+}
 
-      try {
-        auto lock = std::unique_lock<std::mutex>(pointsMu);
+void Outstation::schedule() {
+  if (!started || !pending || scheduled || config.updateMode == "poll") {
+    return;
+  }
 
-        auto point = points.at(tag);
-        builder.Update(opendnp3::Analog(point.value, opendnp3::Flags(1), opendnp3::DNPTime(point.ts)), addr);
+  scheduled = true;
+  applyTask = otsim::msgbus::SharedScheduler().After(config.coalesceWindow, std::bind(&Outstation::apply, this));
+}
+
+void Outstation::apply() {
+  auto applyLock = std::unique_lock<std::mutex>(applyMu);
+
+  std::vector<std::size_t> indexes;
+  std::vector<otsim::msgbus::Point> changed;
+
+  std::optional<std::chrono::steady_clock::time_point> received;
+
+  std::string   traceID;
+  std::uint64_t traceReceived = 0;
 
-        std::cout << fmt::format("[{}] updated analog input {} to {}", config.id, addr, point.value) << std::endl;
-      } catch (const std::out_of_range&) {}
+  {
+    auto lock = std::unique_lock<std::mutex>(pointsMu);
+
+    scheduled = false;
+
+    received.swap(oldestReceived);
+    traceID.swap(oldestTraceID);
+    std::swap(traceReceived, oldestTraceReceived);
+
+    if (!pending) {
+      return;
     }
 
-    for (const auto& kv : analogOutputs) {
-      const std::uint16_t addr = kv.first;
-      const std::string   tag  = kv.second.tag;
+    store.Changed(indexes);
+    pending = false;
 
-      try {
-        auto lock = std::unique_lock<std::mutex>(pointsMu);
+    // Copy the changes out so the lock isn't held while updating the
+    // outstation database.
+    for (auto i : indexes) {
+      changed.push_back(otsim::msgbus::Point{{}, store.Value(i), store.Timestamp(i)});
+    }
+  }
 
-        auto point = points.at(tag);
+  if (changed.empty()) {
+    return;
+  }
+
+  auto traceStart = traceID.empty() ? 0 : otsim::msgbus::TraceNow();
+
+  opendnp3::UpdateBuilder builder;
+
+  for (std::size_t n = 0; n < indexes.size(); ++n) {
+    const auto addr  = store.Address(indexes[n]);
+    const auto point = changed[n];
+
+    switch (store.Type(indexes[n])) {
+      case PointType::BinaryInput:
+        builder.Update(opendnp3::Binary(point.value != 0), addr);
+        logger.Debug("updated binary input {} to {}", addr, point.value);
+
+        break;
+      case PointType::BinaryOutput:
+        builder.Update(opendnp3::BinaryOutputStatus(point.value != 0), addr);
+        logger.Debug("updated binary output {} to {}", addr, point.value);
+
+        break;
+      case PointType::AnalogInput:
+        builder.Update(opendnp3::Analog(point.value, opendnp3::Flags(1), opendnp3::DNPTime(point.ts)), addr);
+        logger.Debug("updated analog input {} to {}", addr, point.value);
+
+        break;
+      case PointType::AnalogOutput:
         builder.Update(opendnp3::AnalogOutputStatus(point.value, opendnp3::Flags(1), opendnp3::DNPTime(point.ts)), addr);
+        logger.Debug("updated analog output {} to {}", addr, point.value);
 
-        std::cout << fmt::format("[{}] updated analog output {} to {}", config.id, addr, point.value) << std::endl;
-      } catch (const std::out_of_range&) {}
+        break;
     }
+  }
+
+  outstation->Apply(builder.Build());
 
-    outstation->Apply(builder.Build());
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+  // Latency of the oldest status message included in this update.
+  if (received) {
+    applyLatency.Observe(std::chrono::steady_clock::now() - *received);
   }
 
-  metrics->Stop();
+  if (!traceID.empty()) {
+    if (traceReceived) {
+      otsim::msgbus::TraceSpan("outstation pending", traceID, traceReceived, traceStart);
+    }
+
+    otsim::msgbus::TraceSpan("outstation apply", traceID, traceStart, otsim::msgbus::TraceNow());
+  }
 }
 
 bool Outstation::AddBinaryInput(BinaryInputPoint point) {
   binaryInputs[point.address] = point;
-  points[point.tag] = otsim::msgbus::Point{point.tag, 0.0, 0};
+  store.Add(PointType::BinaryInput, point.address, point.tag);
 
   return true;
 }
@@ -163,14 +241,14 @@ bool Outstation::AddBinaryOutput(BinaryOutputPoint point) {
   point.output = true;
 
   binaryOutputs[point.address] = point;
-  points[point.tag] = otsim::msgbus::Point{point.tag, 0.0, 0};
+  store.Add(PointType::BinaryOutput, point.address, point.tag);
 
   return true;
 }
 
 bool Outstation::AddAnalogInput(AnalogInputPoint point) {
   analogInputs[point.address] = point;
-  points[point.tag] = otsim::msgbus::Point{point.tag, 0.0, 0};
+  store.Add(PointType::AnalogInput, point.address, point.tag);
 
   return true;
 }
@@ -179,7 +257,7 @@ bool Outstation::AddAnalogOutput(AnalogOutputPoint point) {
   point.output = true;
 
   analogOutputs[point.address] = point;
-  points[point.tag] = otsim::msgbus::Point{point.tag, 0.0, 0};
+  store.Add(PointType::AnalogOutput, point.address, point.tag);
 
   return true;
 }
@@ -190,16 +268,8 @@ void Outstation::WriteBinary(std::uint16_t address, bool status) {
     return;
   }
 
-  std::cout << fmt::format("[{}] setting tag {} to {}", config.id, iter->second.tag, status) << std::endl;
-
-  otsim::msgbus::Points points;
-  points.push_back(otsim::msgbus::Point{iter->second.tag, status ? 1.0 : 0.0});
-
-  otsim::msgbus::Update contents = {.updates = points};
-  auto env = otsim::msgbus::NewEnvelope(config.id, contents);
-
-  pusher->Push("RUNTIME", env);
-  metrics->IncrMetric("update_count");
+  logger.Info("setting tag {} to {}", iter->second.tag, status);
+  write(otsim::msgbus::Point{iter->second.tag, status ? 1.0 : 0.0});
 }
 
 void Outstation::WriteAnalog(std::uint16_t address, double value) {
@@ -208,16 +278,25 @@ void Outstation::WriteAnalog(std::uint16_t address, double value) {
     return;
   }
 
-  std::cout << fmt::format("[{}] setting tag {} to {}", config.id, iter->second.tag, value) << std::endl;
+  logger.Info("setting tag {} to {}", iter->second.tag, value);
+  write(otsim::msgbus::Point{iter->second.tag, value});
+}
 
-  otsim::msgbus::Points points;
-  points.push_back(otsim::msgbus::Point{iter->second.tag, value});
+void Outstation::write(otsim::msgbus::Point point) {
+  if (batching) {
+    batch.push_back(point);
+    return;
+  }
+
+  push({point});
+}
 
+void Outstation::push(const otsim::msgbus::Points& points) {
   otsim::msgbus::Update contents = {.updates = points};
   auto env = otsim::msgbus::NewEnvelope(config.id, contents);
 
   pusher->Push("RUNTIME", env);
-  metrics->IncrMetric("update_count");
+  updateCount.Incr();
 }
 
 const BinaryOutputPoint* Outstation::GetBinaryOutput(const uint16_t address) {
@@ -250,7 +329,7 @@ void Outstation::ResetOutputs() {
   }
 
   if (points.size()) {
-    std::cout << fmt::format("[{}] setting outputs to zero values", config.id) << std::endl;
+    logger.Info("setting outputs to zero values");
 
     otsim::msgbus::Update contents = {.updates = points};
     auto env = otsim::msgbus::NewEnvelope(config.id, contents);
@@ -266,28 +345,88 @@ void Outstation::HandleMsgBusStatus(const otsim::msgbus::Envelope<otsim::msgbus:
     return;
   }
 
-  metrics->IncrMetric("status_count");
+  statusCount.Incr();
+
+  auto now  = std::chrono::steady_clock::now();
+  auto lock = std::unique_lock<std::mutex>(pointsMu);
 
   for (auto &p : env.contents.measurements) {
-    if (points.count(p.tag)) {
-      std::cout << fmt::format("[{}] status received for tag {}", config.id, p.tag) << std::endl;
+    if (store.Set(p.tag, p.value, p.ts)) {
+      logger.Debug("status received for tag {}", p.tag);
+      pending = true;
 
-      auto lock = std::unique_lock<std::mutex>(pointsMu);
-      points[p.tag] = p;
+      if (!oldestReceived) {
+        oldestReceived = now;
+
+        if (otsim::msgbus::Tracing() && env.metadata.count(otsim::msgbus::TRACE_ID)) {
+          oldestTraceID       = env.metadata.at(otsim::msgbus::TRACE_ID);
+          oldestTraceReceived = otsim::msgbus::TraceTimestamp(env.metadata, otsim::msgbus::TRACE_RECEIVED);
+        }
+      }
     }
   }
+
+  schedule();
 }
 
+// Restarts are handled on the shared scheduler rather than in these callbacks,
+// since they're called from the DNP3 stack and disabling the stack from within
+// one of its own callbacks would deadlock.
+
 uint16_t Outstation::ColdRestart() {
-  restartConfig.coldRestart.store(true);
+  auto lock = std::unique_lock<std::mutex>(pointsMu);
+
+  if (started && !restartConfig.coldRestart.exchange(true)) {
+    restartTask = otsim::msgbus::SharedScheduler().After(std::chrono::seconds(0), [this]() {
+      restartConfig.coldRestarter(config.localAddr);
+      restartConfig.coldRestart.store(false);
+    });
+  }
+
   return restartConfig.cold;
 }
 
 uint16_t Outstation::WarmRestart() {
-  restartConfig.warmRestart.store(true);
+  auto lock = std::unique_lock<std::mutex>(pointsMu);
+
+  if (started && !restartConfig.warmRestart.exchange(true)) {
+    restartTask = otsim::msgbus::SharedScheduler().After(std::chrono::seconds(0), [this]() {
+      Disable();
+
+      auto lock = std::unique_lock<std::mutex>(pointsMu);
+
+      // Don't schedule re-enabling the outstation if it was stopped while
+      // being disabled.
+      if (!started) {
+        return;
+      }
+
+      restartTask = otsim::msgbus::SharedScheduler().After(std::chrono::seconds(restartConfig.warm), [this]() {
+        Enable();
+        restartConfig.warmRestart.store(false);
+      });
+    });
+  }
+
   return restartConfig.warm;
 }
 
+void Outstation::Begin() {
+  batching = true;
+  batch.clear();
+}
+
+void Outstation::End() {
+  batching = false;
+
+  if (batch.empty()) {
+    return;
+  }
+
+  push(batch);
+  batch.clear();
+}
+
 opendnp3::CommandStatus Outstation::Select(const opendnp3::ControlRelayOutputBlock& arCommand, std::uint16_t aIndex) {
     if (!GetBinaryOutput(aIndex)) {
         // This is our best guess at what status to return when the address
@@ -299,6 +438,7 @@ opendnp3::CommandStatus Outstation::Select(const opendnp3::ControlRelayOutputBlo
 }
 
 opendnp3::CommandStatus Outstation::Operate(const opendnp3::ControlRelayOutputBlock& arCommand, std::uint16_t aIndex, opendnp3::IUpdateHandler& handler, opendnp3::OperateType opType) {
+    auto timer = operateDuration.Time();
     auto point = GetBinaryOutput(aIndex);
 
     if (!point) {
@@ -339,7 +479,7 @@ opendnp3::CommandStatus Outstation::Operate(const opendnp3::ControlRelayOutputBl
     }
 
     WriteBinary(aIndex, val);
-    metrics->IncrMetric("dnp3_binary_write_count");
+    binaryWriteCount.Incr();
 
     return opendnp3::CommandStatus::SUCCESS;
 }
@@ -355,6 +495,7 @@ opendnp3::CommandStatus Outstation::Select(const opendnp3::AnalogOutputInt16& ar
 }
 
 opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputInt16& arCommand, std::uint16_t aIndex, opendnp3::IUpdateHandler& handler, opendnp3::OperateType opType) {
+    auto timer = operateDuration.Time();
     auto point = GetAnalogOutput(aIndex);
 
     if (!point) {
@@ -368,7 +509,7 @@ opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputInt16& a
     }
 
     WriteAnalog(aIndex, arCommand.value);
-    metrics->IncrMetric("dnp3_analog_write_count");
+    analogWriteCount.Incr();
 
     return opendnp3::CommandStatus::SUCCESS;
 }
@@ -384,6 +525,7 @@ opendnp3::CommandStatus Outstation::Select(const opendnp3::AnalogOutputInt32& ar
 }
 
 opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputInt32& arCommand, std::uint16_t aIndex, opendnp3::IUpdateHandler& handler, opendnp3::OperateType opType) {
+    auto timer = operateDuration.Time();
     auto point = GetAnalogOutput(aIndex);
 
     if (!point) {
@@ -397,7 +539,7 @@ opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputInt32& a
     }
 
     WriteAnalog(aIndex, arCommand.value);
-    metrics->IncrMetric("dnp3_analog_write_count");
+    analogWriteCount.Incr();
 
     return opendnp3::CommandStatus::SUCCESS;
 }
@@ -413,6 +555,7 @@ opendnp3::CommandStatus Outstation::Select(const opendnp3::AnalogOutputFloat32&
 }
 
 opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputFloat32& arCommand, std::uint16_t aIndex, opendnp3::IUpdateHandler& handler, opendnp3::OperateType opType) {
+    auto timer = operateDuration.Time();
     auto point = GetAnalogOutput(aIndex);
 
     if (!point) {
@@ -426,7 +569,7 @@ opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputFloat32&
     }
 
     WriteAnalog(aIndex, arCommand.value);
-    metrics->IncrMetric("dnp3_analog_write_count");
+    analogWriteCount.Incr();
 
     return opendnp3::CommandStatus::SUCCESS;
 }
@@ -442,6 +585,7 @@ opendnp3::CommandStatus Outstation::Select(const opendnp3::AnalogOutputDouble64&
 }
 
 opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputDouble64& arCommand, std::uint16_t aIndex, opendnp3::IUpdateHandler& handler, opendnp3::OperateType opType) {
+    auto timer = operateDuration.Time();
     auto point = GetAnalogOutput(aIndex);
 
     if (!point) {
@@ -455,7 +599,7 @@ opendnp3::CommandStatus Outstation::Operate(const opendnp3::AnalogOutputDouble64
     }
 
     WriteAnalog(aIndex, arCommand.value);
-    metrics->IncrMetric("dnp3_analog_write_count");
+    analogWriteCount.Incr();
 
     return opendnp3::CommandStatus::SUCCESS;
 }
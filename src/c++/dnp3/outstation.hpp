@@ -2,14 +2,18 @@
 #define OTSIM_DNP3_OUTSTATION_HPP
 
 #include <atomic>
+#include <chrono>
 #include <mutex>
-#include <thread>
+#include <optional>
 
 #include "common.hpp"
+#include "logger.hpp"
+#include "store.hpp"
 
 #include "msgbus/envelope.hpp"
 #include "msgbus/metrics.hpp"
 #include "msgbus/pusher.hpp"
+#include "msgbus/scheduler.hpp"
 
 #include "opendnp3/gen/RestartType.h"
 #include "opendnp3/outstation/DefaultOutstationApplication.h"
@@ -27,8 +31,9 @@ struct OutstationRestartConfig {
   std::uint16_t warm {};
   std::uint16_t cold {};
 
-  std::atomic<bool> coldRestart;
-  std::atomic<bool> warmRestart;
+  // Set while a restart is in progress.
+  std::atomic<bool> coldRestart {false};
+  std::atomic<bool> warmRestart {false};
 
   ColdRestartFunc coldRestarter;
 
@@ -42,7 +47,20 @@ struct OutstationConfig {
   std::uint16_t localAddr  {};
   std::uint16_t remoteAddr {};
 
+  // One of "debug", "info", "warn" or "error".
   std::string logLevel = "info";
+
+  // Maximum number of times per second each distinct log message is logged.
+  // Zero means no limit.
+  std::uint32_t logRateLimit = 100;
+
+  // Either "event" to apply points to the outstation database as soon as
+  // they change, or "poll" to apply every point once per second.
+  std::string updateMode = "event";
+
+  // How long to wait after the first point changes before applying changes,
+  // so bursts of changes get applied as a single update.
+  std::chrono::milliseconds coalesceWindow {};
 };
 
 class Outstation : public opendnp3::DefaultOutstationApplication, public opendnp3::ICommandHandler {
@@ -61,17 +79,14 @@ public:
 
   void SetIOutstation(std::shared_ptr<opendnp3::IOutstation> o) { outstation = o; }
 
-  bool Enable() {
-    running.store(true);
-    return outstation->Enable();
-  }
-
-  bool Disable() {
-    running.store(false);
-    return outstation->Disable();
-  }
+  bool Enable()  { return outstation->Enable(); }
+  bool Disable() { return outstation->Disable(); }
 
-  void Run();
+  // Start schedules applying point changes to the outstation database (and
+  // pushing metrics) on the shared scheduler. Stop cancels any scheduled tasks,
+  // including pending restarts, waiting for any that are currently running.
+  void Start();
+  void Stop();
 
   bool AddBinaryInput(BinaryInputPoint point);
   bool AddBinaryOutput(BinaryOutputPoint point);
@@ -117,28 +132,79 @@ public:
 
 protected:
   // BEGIN ICommandHandler Implementation
-  virtual void Begin() override {}
-  virtual void End() override {}
+  virtual void Begin() override;
+  virtual void End() override;
   // END ICommandHandler Implementation
 
 private:
+  // Pushes an Update for the given point, or adds it to the current batch if
+  // called between Begin and End.
+  void write(otsim::msgbus::Point point);
+  void push(const otsim::msgbus::Points& points);
+
+  // Schedules an apply if points have changed and one isn't already scheduled.
+  // Must be called with pointsMu held.
+  void schedule();
+  void apply();
+
   OutstationConfig config;
   OutstationRestartConfig restartConfig;
 
   Pusher pusher;
   MetricsPusher metrics;
+  Logger logger;
+
+  otsim::msgbus::MetricHandle statusCount;
+  otsim::msgbus::MetricHandle updateCount;
+  otsim::msgbus::MetricHandle binaryWriteCount;
+  otsim::msgbus::MetricHandle analogWriteCount;
+
+  otsim::msgbus::HistogramHandle applyLatency;
+  otsim::msgbus::HistogramHandle operateDuration;
 
   std::shared_ptr<opendnp3::IOutstation> outstation;
 
+  // Writes made by the operates of a single DNP3 request (between Begin and
+  // End) are pushed as a single Update, so downstream modules never see a
+  // multi-point request half applied. Only touched by the outstation's
+  // executor, which is the only thread opendnp3 calls the command handler on.
+  bool batching = false;
+  otsim::msgbus::Points batch;
+
   std::map<std::uint16_t, BinaryInputPoint> binaryInputs;
   std::map<std::uint16_t, BinaryOutputPoint> binaryOutputs;
   std::map<std::uint16_t, AnalogInputPoint> analogInputs;
   std::map<std::uint16_t, AnalogOutputPoint> analogOutputs;
 
-  std::map<std::string, otsim::msgbus::Point> points;
+  // Current values of all the points above. Protected by pointsMu.
+  PointStore store;
   std::mutex pointsMu;
 
-  std::atomic<bool> running;
+  // Set when point values have been received since the last time points were
+  // applied to the outstation database. Protected by pointsMu.
+  bool pending {};
+
+  // When the oldest status message not yet applied to the outstation database
+  // was received. Protected by pointsMu.
+  std::optional<std::chrono::steady_clock::time_point> oldestReceived;
+
+  // Trace ID and receive time (in trace time) of that same status message,
+  // if tracing is enabled and it was traced. Protected by pointsMu.
+  std::string   oldestTraceID       {};
+  std::uint64_t oldestTraceReceived {};
+
+  // Scheduler state, also protected by pointsMu. In event mode applyTask is
+  // the next one-shot apply (if scheduled is set); in poll mode it's the
+  // periodic apply.
+  bool started   {};
+  bool scheduled {};
+
+  otsim::msgbus::Scheduler::TaskID applyTask   {};
+  otsim::msgbus::Scheduler::TaskID restartTask {};
+
+  // Held while applying so applies running on different scheduler workers
+  // can't apply changes out of order.
+  std::mutex applyMu;
 };
 
 } // namespace dnp3
@@ -1,11 +1,9 @@
-#include <iostream>
-
 #include "server.hpp"
+#include "manager.hpp"
 
 #include "opendnp3/channel/ChannelRetry.h"
 #include "opendnp3/channel/IPEndpoint.h"
 #include "opendnp3/channel/SerialSettings.h"
-#include "opendnp3/ConsoleLogger.h"
 #include "opendnp3/gen/ServerAcceptMode.h"
 #include "opendnp3/logging/LogLevels.h"
 #include "opendnp3/outstation/DefaultOutstationApplication.h"
@@ -17,10 +15,12 @@ namespace dnp3 {
 
 Server::Server(const std::uint16_t cold) : coldRestartSecs(cold)
 {
-    manager.reset(new opendnp3::DNP3Manager(std::thread::hardware_concurrency(), opendnp3::ConsoleLogger::Create()));
+    manager = SharedManager();
 }
 
 bool Server::Init(const std::string& id, const opendnp3::IPEndpoint endpoint, const opendnp3::ServerAcceptMode acceptMode) {
+    logger.SetName(id);
+
     try {
         channel = manager->AddTCPServer(
             id,
@@ -37,6 +37,8 @@ bool Server::Init(const std::string& id, const opendnp3::IPEndpoint endpoint, co
 }
 
 bool Server::Init(const std::string& id, const opendnp3::SerialSettings serial, const opendnp3::ChannelRetry channelRetry) {
+    logger.SetName(id);
+
     try {
         channel = manager->AddSerial(
             id,
@@ -53,7 +55,7 @@ bool Server::Init(const std::string& id, const opendnp3::SerialSettings serial,
 }
 
 std::shared_ptr<Outstation> Server::AddOutstation(OutstationConfig config, OutstationRestartConfig restart, Pusher pusher) {
-    std::cout << "adding outstation " << config.remoteAddr << " --> " << config.localAddr << std::endl;
+    logger.Info("adding outstation {} --> {}", config.remoteAddr, config.localAddr);
 
     restart.cold = coldRestartSecs;
     restart.coldRestarter = std::bind(&Server::HandleColdRestart, this, std::placeholders::_1);
@@ -73,26 +75,33 @@ void Server::Start() {
 
         outstation->SetIOutstation(iOutstation);
         outstation->Enable();
-
-        threads.push_back(std::thread(std::bind(&Outstation::Run, outstation)));
+        outstation->Start();
     }
 }
 
 void Server::Stop() {
+    // Stop outstations first so none of them can start a new cold restart.
     for (const auto& kv : outstations) {
-        kv.second->Disable();
+        kv.second->Stop();
     }
 
-    for (auto &t : threads) {
-        if (t.joinable()) {
-            t.join();
-        }
+    otsim::msgbus::Scheduler::TaskID restart;
+
+    {
+        auto lock = std::unique_lock<std::mutex>(restartMu);
+        restart = restartTask;
+    }
+
+    otsim::msgbus::SharedScheduler().Cancel(restart);
+
+    for (const auto& kv : outstations) {
+        kv.second->Disable();
     }
 }
 
 void Server::HandleColdRestart(std::uint16_t outstation) {
     for (const auto& kv : outstations) {
-        std::cout << "disabling outstation " << kv.first << " for " << coldRestartSecs << " seconds" << std::endl;
+        logger.Info("disabling outstation {} for {} seconds", kv.first, coldRestartSecs);
 
         auto outstation = kv.second;
 
@@ -100,12 +109,14 @@ void Server::HandleColdRestart(std::uint16_t outstation) {
         outstation->Disable();
     }
 
-    std::this_thread::sleep_for(std::chrono::seconds(coldRestartSecs));
+    auto lock = std::unique_lock<std::mutex>(restartMu);
 
-    for (const auto& kv : outstations) {
-        std::cout << "enabling outstation " << kv.first << std::endl;
-        kv.second->Enable();
-    }
+    restartTask = otsim::msgbus::SharedScheduler().After(std::chrono::seconds(coldRestartSecs), [this]() {
+        for (const auto& kv : outstations) {
+            logger.Info("enabling outstation {}", kv.first);
+            kv.second->Enable();
+        }
+    });
 }
 
 } // namespace dnp3
@@ -1,8 +1,9 @@
 #ifndef OTSIM_DNP3_SERVER_HPP
 #define OTSIM_DNP3_SERVER_HPP
 
-#include <thread>
+#include <mutex>
 
+#include "logger.hpp"
 #include "outstation.hpp"
 
 #include "opendnp3/DNP3Manager.h"
@@ -30,17 +31,20 @@ public:
   void HandleColdRestart(std::uint16_t outstation);
 
 private:
-  std::shared_ptr<opendnp3::DNP3Manager> manager;    // Outstation stack manager
+  std::shared_ptr<opendnp3::DNP3Manager> manager;    // Shared stack manager
   std::shared_ptr<opendnp3::IChannel> channel;       // TCPServer channel
 
+  Logger logger {"dnp3"}; // renamed to the channel ID by Init
+
   std::uint16_t coldRestartSecs;
 
   // Keep track of warm restart delay and binary/analog points per-outstation.
   // The key is the outstation local address.
   std::map<std::uint16_t, std::shared_ptr<Outstation>> outstations;
 
-  // Keep outstation threads in scope so they don't terminate immediately.
-  std::vector<std::thread> threads;
+  // Re-enables outstations after a cold restart. Protected by restartMu.
+  otsim::msgbus::Scheduler::TaskID restartTask {};
+  std::mutex restartMu;
 };
 
 } // namespace dnp3
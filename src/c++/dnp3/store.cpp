@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <limits>
+
+#include "store.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace otsim {
+namespace dnp3 {
+
+namespace {
+
+// Change detection kernels set bit (i % 64) of bits[i / 64] for each point
+// whose value differs from its last applied value. Unordered comparisons are
+// used so a NaN applied value (never applied) is always considered changed.
+// Bits must be zeroed by the caller.
+typedef void (*Kernel)(const double* v, const double* a, std::uint64_t* bits, std::size_t n);
+
+void scalarKernel(const double* v, const double* a, std::uint64_t* bits, std::size_t start, std::size_t n) {
+  for (std::size_t i = start; i < n; ++i) {
+    if (!(v[i] == a[i])) {
+      bits[i >> 6] |= std::uint64_t(1) << (i & 63);
+    }
+  }
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of the x86-64 baseline, so this is always available.
+void sse2Kernel(const double* v, const double* a, std::uint64_t* bits, std::size_t n) {
+  std::size_t i = 0;
+
+  for (; i + 2 <= n; i += 2) {
+    auto m = _mm_movemask_pd(_mm_cmpneq_pd(_mm_loadu_pd(v + i), _mm_loadu_pd(a + i)));
+    bits[i >> 6] |= std::uint64_t(m) << (i & 63);
+  }
+
+  scalarKernel(v, a, bits, i, n);
+}
+
+__attribute__((target("avx")))
+void avxKernel(const double* v, const double* a, std::uint64_t* bits, std::size_t n) {
+  std::size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    auto m = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(v + i), _mm256_loadu_pd(a + i), _CMP_NEQ_UQ));
+    bits[i >> 6] |= std::uint64_t(m) << (i & 63);
+  }
+
+  scalarKernel(v, a, bits, i, n);
+}
+#else
+void genericKernel(const double* v, const double* a, std::uint64_t* bits, std::size_t n) {
+  scalarKernel(v, a, bits, 0, n);
+}
+#endif
+
+Kernel selectKernel() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx")) {
+    return avxKernel;
+  }
+
+  return sse2Kernel;
+#else
+  return genericKernel;
+#endif
+}
+
+const Kernel kernel = selectKernel();
+
+} // namespace
+
+std::size_t PointStore::Add(PointType type, std::uint16_t address, const std::string& tag) {
+  auto i = values.size();
+
+  types.push_back(type);
+  addresses.push_back(address);
+  values.push_back(0.0);
+  timestamps.push_back(0);
+  applied.push_back(std::numeric_limits<double>::quiet_NaN());
+
+  bits.resize((values.size() + 63) / 64);
+
+  index[tag].push_back(i);
+
+  return i;
+}
+
+bool PointStore::Set(const std::string& tag, double value, std::uint64_t ts) {
+  auto iter = index.find(tag);
+  if (iter == index.end()) {
+    return false;
+  }
+
+  for (auto i : iter->second) {
+    values[i]     = value;
+    timestamps[i] = ts;
+  }
+
+  return true;
+}
+
+void PointStore::Changed(std::vector<std::size_t>& changed) {
+  std::fill(bits.begin(), bits.end(), 0);
+  kernel(values.data(), applied.data(), bits.data(), values.size());
+
+  // Changes are typically sparse, so only visit set bits.
+  for (std::size_t w = 0; w < bits.size(); ++w) {
+    auto word = bits[w];
+
+    while (word) {
+      auto i = (w << 6) + __builtin_ctzll(word);
+
+      applied[i] = values[i];
+      changed.push_back(i);
+
+      word &= word - 1;
+    }
+  }
+}
+
+void PointStore::Invalidate() {
+  std::fill(applied.begin(), applied.end(), std::numeric_limits<double>::quiet_NaN());
+}
+
+} // namespace dnp3
+} // namespace otsim
@@ -0,0 +1,349 @@
+#include <cstring>
+#include <limits>
+
+#include "codec.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+namespace {
+
+// All integers are written little-endian, strings are length-prefixed with a
+// 16-bit length and collections are prefixed with a 32-bit count.
+class Writer {
+public:
+  Writer(const std::string& kind, const Metadata& metadata) {
+    buf.push_back(static_cast<char>(BINARY_VERSION_BYTE));
+
+    String(kind);
+
+    U32(metadata.size());
+
+    for (const auto& [k, v] : metadata) {
+      String(k);
+      String(v);
+    }
+  }
+
+  void U32(std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      buf.push_back(static_cast<char>((v >> (i * 8)) & 0xFF));
+    }
+  }
+
+  void U64(std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+      buf.push_back(static_cast<char>((v >> (i * 8)) & 0xFF));
+    }
+  }
+
+  void F64(double v) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+
+    U64(bits);
+  }
+
+  void String(const std::string& s) {
+    if (s.size() > std::numeric_limits<std::uint16_t>::max()) {
+      throw std::length_error("string too long for binary envelope");
+    }
+
+    buf.push_back(static_cast<char>(s.size() & 0xFF));
+    buf.push_back(static_cast<char>((s.size() >> 8) & 0xFF));
+    buf.append(s);
+  }
+
+  void Points(const otsim::msgbus::Points& points) {
+    U32(points.size());
+
+    for (const auto& p : points) {
+      String(p.tag);
+      F64(p.value);
+      U64(p.ts);
+    }
+  }
+
+  std::string buf;
+};
+
+class Reader {
+public:
+  Reader(const void* data, std::size_t size) : data(static_cast<const std::uint8_t*>(data)), size(size) {
+    if (!IsBinary(data, size)) {
+      throw DecodeError("not a binary envelope");
+    }
+
+    pos = 1;
+  }
+
+  std::uint32_t U32() {
+    need(4);
+
+    std::uint32_t v = 0;
+
+    for (int i = 0; i < 4; ++i) {
+      v |= static_cast<std::uint32_t>(data[pos++]) << (i * 8);
+    }
+
+    return v;
+  }
+
+  std::uint64_t U64() {
+    need(8);
+
+    std::uint64_t v = 0;
+
+    for (int i = 0; i < 8; ++i) {
+      v |= static_cast<std::uint64_t>(data[pos++]) << (i * 8);
+    }
+
+    return v;
+  }
+
+  double F64() {
+    auto bits = U64();
+
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+
+    return v;
+  }
+
+  std::string String() {
+    std::string s;
+    String(s);
+
+    return s;
+  }
+
+  // Assigns to the given string, reusing its existing capacity.
+  void String(std::string& s) {
+    need(2);
+
+    std::size_t len = data[pos] | (data[pos + 1] << 8);
+    pos += 2;
+
+    need(len);
+
+    s.assign(reinterpret_cast<const char*>(data + pos), len);
+    pos += len;
+  }
+
+  void Points(otsim::msgbus::Points& points) {
+    auto count = U32();
+
+    // Each point is at least 18 bytes, so don't trust counts that can't
+    // possibly fit in the remaining buffer.
+    if (count > (size - pos) / 18) {
+      throw DecodeError("point count exceeds message size");
+    }
+
+    // Reuse any existing points (and their tag strings) when decoding into
+    // an envelope that's decoded into repeatedly.
+    points.resize(count);
+
+    for (auto& p : points) {
+      String(p.tag);
+
+      p.value = F64();
+      p.ts    = U64();
+    }
+  }
+
+  template<typename T>
+  void Header(Envelope<T>& env, const std::string& expected) {
+    env.version = BINARY_VERSION;
+    env.kind    = String();
+
+    if (env.kind != expected) {
+      throw DecodeError("expected " + expected + " envelope but got " + env.kind);
+    }
+
+    env.metadata.clear();
+
+    auto count = U32();
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+      auto k = String();
+      env.metadata[k] = String();
+    }
+  }
+
+private:
+  void need(std::size_t n) {
+    if (size - pos < n) {
+      throw DecodeError("binary envelope truncated");
+    }
+  }
+
+  const std::uint8_t* data;
+  std::size_t size;
+  std::size_t pos;
+};
+
+} // namespace
+
+Encoding ParseEncoding(const std::string& name) {
+  if (name == "json") {
+    return Encoding::JSON;
+  }
+
+  if (name == "binary") {
+    return Encoding::Binary;
+  }
+
+  throw std::invalid_argument("unknown message bus encoding " + name);
+}
+
+std::string EncodeBinary(const Envelope<Status>& env) {
+  Writer w("Status", env.metadata);
+  w.Points(env.contents.measurements);
+
+  return w.buf;
+}
+
+std::string EncodeBinary(const Envelope<Update>& env) {
+  Writer w("Update", env.metadata);
+
+  w.Points(env.contents.updates);
+  w.String(env.contents.recipient);
+  w.String(env.contents.confirm);
+
+  return w.buf;
+}
+
+std::string EncodeBinary(const Envelope<Confirmation>& env) {
+  Writer w("Confirmation", env.metadata);
+
+  w.String(env.contents.confirm);
+  w.U32(env.contents.errors.size());
+
+  for (const auto& [k, v] : env.contents.errors) {
+    w.String(k);
+    w.String(v);
+  }
+
+  return w.buf;
+}
+
+std::string EncodeBinary(const Envelope<Metrics>& env) {
+  Writer w("Metric", env.metadata);
+
+  w.U32(env.contents.metrics.size());
+
+  for (const auto& m : env.contents.metrics) {
+    w.String(m.kind);
+    w.String(m.name);
+    w.String(m.desc);
+    w.F64(m.value);
+
+    w.U64(m.count);
+    w.F64(m.sum);
+    w.U32(m.buckets.size());
+
+    for (const auto& b : m.buckets) {
+      w.F64(b.upper);
+      w.U64(b.count);
+    }
+
+    w.U32(m.quantiles.size());
+
+    for (const auto& q : m.quantiles) {
+      w.F64(q.quantile);
+      w.F64(q.value);
+    }
+  }
+
+  return w.buf;
+}
+
+bool IsBinary(const void* data, std::size_t size) {
+  return size > 0 && static_cast<const std::uint8_t*>(data)[0] == BINARY_VERSION_BYTE;
+}
+
+std::string BinaryKind(const void* data, std::size_t size) {
+  Reader r(data, size);
+  return r.String();
+}
+
+void DecodeBinary(const void* data, std::size_t size, Envelope<Status>& env) {
+  Reader r(data, size);
+
+  r.Header(env, "Status");
+  r.Points(env.contents.measurements);
+}
+
+void DecodeBinary(const void* data, std::size_t size, Envelope<Update>& env) {
+  Reader r(data, size);
+
+  r.Header(env, "Update");
+  r.Points(env.contents.updates);
+
+  env.contents.recipient = r.String();
+  env.contents.confirm   = r.String();
+}
+
+void DecodeBinary(const void* data, std::size_t size, Envelope<Confirmation>& env) {
+  Reader r(data, size);
+
+  r.Header(env, "Confirmation");
+
+  env.contents.confirm = r.String();
+  env.contents.errors.clear();
+
+  auto count = r.U32();
+
+  for (std::uint32_t i = 0; i < count; ++i) {
+    auto k = r.String();
+    env.contents.errors[k] = r.String();
+  }
+}
+
+void DecodeBinary(const void* data, std::size_t size, Envelope<Metrics>& env) {
+  Reader r(data, size);
+
+  r.Header(env, "Metric");
+
+  auto count = r.U32();
+
+  env.contents.metrics.clear();
+
+  for (std::uint32_t i = 0; i < count; ++i) {
+    Metric m;
+
+    m.kind  = r.String();
+    m.name  = r.String();
+    m.desc  = r.String();
+    m.value = r.F64();
+    m.count = r.U64();
+    m.sum   = r.F64();
+
+    auto buckets = r.U32();
+
+    for (std::uint32_t b = 0; b < buckets; ++b) {
+      HistogramBucket bucket;
+
+      bucket.upper = r.F64();
+      bucket.count = r.U64();
+
+      m.buckets.push_back(bucket);
+    }
+
+    auto quantiles = r.U32();
+
+    for (std::uint32_t q = 0; q < quantiles; ++q) {
+      SummaryQuantile quantile;
+
+      quantile.quantile = r.F64();
+      quantile.value    = r.F64();
+
+      m.quantiles.push_back(quantile);
+    }
+
+    env.contents.metrics.push_back(std::move(m));
+  }
+}
+
+} // namespace msgbus
+} // namespace otsim
@@ -0,0 +1,68 @@
+#ifndef OTSIM_MSGBUS_CODEC_HPP
+#define OTSIM_MSGBUS_CODEC_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "envelope.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+namespace otsim {
+namespace msgbus {
+
+// Envelopes can be encoded on the wire as JSON (the default, and the only
+// encoding understood by the Golang and Python modules) or as a compact binary
+// encoding only understood by the C++ modules.
+//
+// Binary envelopes start with a version byte that can never be the first byte
+// of a JSON document, so subscribers can tell the two apart and both can
+// coexist on the same message bus. Decoded binary envelopes report the binary
+// version string as their version.
+enum class Encoding { JSON, Binary };
+
+const std::uint8_t BINARY_VERSION_BYTE = 0xB1;
+const std::string  BINARY_VERSION      = "b1";
+
+// Parses "json" or "binary". Throws std::invalid_argument for anything else.
+Encoding ParseEncoding(const std::string& name);
+
+struct DecodeError : public std::runtime_error {
+  DecodeError(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+std::string EncodeBinary(const Envelope<Status>& env);
+std::string EncodeBinary(const Envelope<Update>& env);
+std::string EncodeBinary(const Envelope<Confirmation>& env);
+std::string EncodeBinary(const Envelope<Metrics>& env);
+
+template<typename T>
+std::string Encode(const Envelope<T>& env, Encoding encoding) {
+  if (encoding == Encoding::Binary) {
+    return EncodeBinary(env);
+  }
+
+  json j = env;
+  return j.dump();
+}
+
+// Returns true if the given message was encoded using the binary encoding.
+bool IsBinary(const void* data, std::size_t size);
+
+// Returns the kind of the given binary envelope without decoding its
+// contents. Throws DecodeError if the message is malformed.
+std::string BinaryKind(const void* data, std::size_t size);
+
+// The following throw DecodeError if the message is malformed or if the kind
+// of the envelope doesn't match the type being decoded into.
+void DecodeBinary(const void* data, std::size_t size, Envelope<Status>& env);
+void DecodeBinary(const void* data, std::size_t size, Envelope<Update>& env);
+void DecodeBinary(const void* data, std::size_t size, Envelope<Confirmation>& env);
+void DecodeBinary(const void* data, std::size_t size, Envelope<Metrics>& env);
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_CODEC_HPP
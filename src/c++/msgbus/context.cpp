@@ -0,0 +1,15 @@
+#include "context.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+zmq::context_t& Context() {
+  // Intentionally never destroyed, since terminating a context blocks until
+  // every socket using it has been closed, and some sockets may be owned by
+  // threads still running when the process exits.
+  static zmq::context_t* ctx = new zmq::context_t();
+  return *ctx;
+}
+
+} // namespace msgbus
+} // namespace otsim
@@ -0,0 +1,18 @@
+#ifndef OTSIM_MSGBUS_CONTEXT_HPP
+#define OTSIM_MSGBUS_CONTEXT_HPP
+
+#include "cppzmq/zmq.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+// Returns the ZMQ context shared by every message bus socket in the process.
+// Sharing a context keeps the number of ZMQ I/O threads constant no matter how
+// many pushers and subscribers a process creates, and lets sockets in the same
+// process communicate over inproc endpoints.
+zmq::context_t& Context();
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_CONTEXT_HPP
@@ -0,0 +1,316 @@
+#include "decoder.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+Decoder::Decoder() {
+  stack.reserve(8);
+  reset();
+}
+
+const std::string& Decoder::Decode(const void* data, std::size_t size) {
+  if (IsBinary(data, size)) {
+    kind = BinaryKind(data, size);
+
+    if (kind == "Status") {
+      DecodeBinary(data, size, status);
+    } else if (kind == "Update") {
+      DecodeBinary(data, size, update);
+    }
+
+    return kind;
+  }
+
+  reset();
+
+  auto begin = static_cast<const char*>(data);
+
+  if (!json::sax_parse(begin, begin + size, this)) {
+    throw DecodeError(error);
+  }
+
+  if (kind == "Status") {
+    if (!measurementsSeen) {
+      status.contents.measurements.clear();
+    }
+
+    status.version = version;
+    status.kind    = kind;
+    status.metadata.swap(metadata);
+  } else if (kind == "Update") {
+    if (!updatesSeen) {
+      update.contents.updates.clear();
+    }
+
+    update.version = version;
+    update.kind    = kind;
+    update.metadata.swap(metadata);
+  }
+
+  return kind;
+}
+
+void Decoder::reset() {
+  version.clear();
+  kind.clear();
+  metadata.clear();
+
+  update.contents.recipient.clear();
+  update.contents.confirm.clear();
+
+  stack.clear();
+
+  field = Field::None;
+  skip  = 0;
+
+  points = nullptr;
+  count  = 0;
+  point  = nullptr;
+
+  measurementsSeen = false;
+  updatesSeen      = false;
+
+  error.clear();
+}
+
+bool Decoder::null() {
+  if (skip) {
+    return true;
+  }
+
+  // Golang encodes empty slices as null.
+  if (field == Field::Measurements) {
+    status.contents.measurements.clear();
+    measurementsSeen = true;
+  } else if (field == Field::Updates) {
+    update.contents.updates.clear();
+    updatesSeen = true;
+  }
+
+  field = Field::None;
+  return true;
+}
+
+bool Decoder::boolean(bool val) {
+  number(val ? 1.0 : 0.0);
+  return true;
+}
+
+bool Decoder::number_integer(number_integer_t val) {
+  number(static_cast<double>(val));
+  return true;
+}
+
+bool Decoder::number_unsigned(number_unsigned_t val) {
+  if (!skip && field == Field::Timestamp) {
+    point->ts = val;
+    field = Field::None;
+
+    return true;
+  }
+
+  number(static_cast<double>(val));
+  return true;
+}
+
+bool Decoder::number_float(number_float_t val, const string_t&) {
+  number(val);
+  return true;
+}
+
+void Decoder::number(double val) {
+  if (skip) {
+    return;
+  }
+
+  if (field == Field::Value) {
+    point->value = val;
+  } else if (field == Field::Timestamp) {
+    point->ts = static_cast<std::uint64_t>(val);
+  }
+
+  field = Field::None;
+}
+
+bool Decoder::string(string_t& val) {
+  if (skip) {
+    return true;
+  }
+
+  switch (field) {
+    case Field::Version:
+      version.assign(val);
+      break;
+    case Field::Kind:
+      kind.assign(val);
+      break;
+    case Field::MetadataValue:
+      metadata[metadataKey].assign(val);
+      break;
+    case Field::Recipient:
+      update.contents.recipient.assign(val);
+      break;
+    case Field::Confirm:
+      update.contents.confirm.assign(val);
+      break;
+    case Field::Tag:
+      point->tag.assign(val);
+      break;
+    default:
+      break;
+  }
+
+  field = Field::None;
+  return true;
+}
+
+bool Decoder::binary(binary_t&) {
+  field = Field::None;
+  return true;
+}
+
+bool Decoder::start_object(std::size_t) {
+  if (skip) {
+    ++skip;
+    return true;
+  }
+
+  if (stack.empty()) {
+    stack.push_back(Context::Envelope);
+  } else if (stack.back() == Context::Envelope && field == Field::Metadata) {
+    stack.push_back(Context::Metadata);
+  } else if (stack.back() == Context::Envelope && field == Field::Contents) {
+    stack.push_back(Context::Contents);
+  } else if (stack.back() == Context::Points) {
+    if (count < points->size()) {
+      point = &(*points)[count];
+    } else {
+      point = &points->emplace_back();
+    }
+
+    point->tag.clear();
+    point->value = 0.0;
+    point->ts    = 0;
+
+    stack.push_back(Context::Point);
+  } else {
+    skip = 1;
+  }
+
+  field = Field::None;
+  return true;
+}
+
+bool Decoder::key(string_t& val) {
+  if (skip) {
+    return true;
+  }
+
+  field = Field::Skip;
+
+  switch (stack.back()) {
+    case Context::Envelope:
+      if (val == "version") {
+        field = Field::Version;
+      } else if (val == "kind") {
+        field = Field::Kind;
+      } else if (val == "metadata") {
+        field = Field::Metadata;
+      } else if (val == "contents") {
+        field = Field::Contents;
+      }
+
+      break;
+    case Context::Metadata:
+      metadataKey.assign(val);
+      field = Field::MetadataValue;
+
+      break;
+    case Context::Contents:
+      if (val == "measurements") {
+        field = Field::Measurements;
+      } else if (val == "updates") {
+        field = Field::Updates;
+      } else if (val == "recipient") {
+        field = Field::Recipient;
+      } else if (val == "confirm") {
+        field = Field::Confirm;
+      }
+
+      break;
+    case Context::Point:
+      if (val == "tag") {
+        field = Field::Tag;
+      } else if (val == "value") {
+        field = Field::Value;
+      } else if (val == "ts") {
+        field = Field::Timestamp;
+      }
+
+      break;
+    default:
+      break;
+  }
+
+  return true;
+}
+
+bool Decoder::end_object() {
+  if (skip) {
+    --skip;
+    return true;
+  }
+
+  if (stack.back() == Context::Point) {
+    ++count;
+  }
+
+  stack.pop_back();
+  return true;
+}
+
+bool Decoder::start_array(std::size_t) {
+  if (skip) {
+    ++skip;
+    return true;
+  }
+
+  if (field == Field::Measurements) {
+    points = &status.contents.measurements;
+    measurementsSeen = true;
+  } else if (field == Field::Updates) {
+    points = &update.contents.updates;
+    updatesSeen = true;
+  } else {
+    skip = 1;
+    return true;
+  }
+
+  count = 0;
+  field = Field::None;
+
+  stack.push_back(Context::Points);
+  return true;
+}
+
+bool Decoder::end_array() {
+  if (skip) {
+    --skip;
+    return true;
+  }
+
+  // Only shrinks (or leaves alone) the points since they're added as they're
+  // decoded, keeping any existing tag strings around for reuse.
+  points->resize(count);
+
+  stack.pop_back();
+  return true;
+}
+
+bool Decoder::parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) {
+  error = ex.what();
+  return false;
+}
+
+} // namespace msgbus
+} // namespace otsim
@@ -0,0 +1,91 @@
+#ifndef OTSIM_MSGBUS_DECODER_HPP
+#define OTSIM_MSGBUS_DECODER_HPP
+
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "envelope.hpp"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+namespace otsim {
+namespace msgbus {
+
+// Decoder decodes Status and Update envelopes straight from a message buffer,
+// using the SAX interface for JSON envelopes so no intermediate JSON DOM (or
+// copy of the message) is created. The same envelope storage is reused for
+// every message decoded, so steady-state decoding of similarly sized messages
+// doesn't need to allocate new points or tag strings.
+//
+// References returned by the envelope accessors are only valid until the next
+// call to Decode. A Decoder is not thread-safe.
+class Decoder : public nlohmann::json_sax<json> {
+public:
+  Decoder();
+
+  // Decodes the given JSON or binary envelope, returning its kind. Envelopes of
+  // kinds other than Status and Update have their kind returned but are not
+  // otherwise decoded. Throws DecodeError if the message is malformed.
+  const std::string& Decode(const void* data, std::size_t size);
+
+  const Envelope<Status>& StatusEnvelope() const { return status; }
+  const Envelope<Update>& UpdateEnvelope() const { return update; }
+
+  Envelope<Status>& StatusEnvelope() { return status; }
+  Envelope<Update>& UpdateEnvelope() { return update; }
+
+  // BEGIN json_sax Implementation
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t& s) override;
+  bool string(string_t& val) override;
+  bool binary(binary_t& val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t& val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& ex) override;
+  // END json_sax Implementation
+
+private:
+  enum class Context { Envelope, Metadata, Contents, Points, Point };
+  enum class Field { None, Skip, Version, Kind, Metadata, MetadataValue, Contents, Measurements, Updates, Recipient, Confirm, Tag, Value, Timestamp };
+
+  void reset();
+  void number(double val);
+
+  Envelope<Status> status;
+  Envelope<Update> update;
+
+  std::string version;
+  std::string kind;
+  Metadata    metadata;
+
+  std::vector<Context> stack;
+  Field field;
+
+  // Depth of nested values being skipped since they aren't part of a known
+  // envelope field.
+  int skip;
+
+  std::string metadataKey;
+
+  Points*     points;
+  std::size_t count;
+  Point*      point;
+
+  bool measurementsSeen;
+  bool updatesSeen;
+
+  std::string error;
+};
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_DECODER_HPP
@@ -46,11 +46,31 @@ struct Confirmation {
   ConfirmationErrors errors  {};
 };
 
+// Number of observations less than or equal to upper (cumulative, the same
+// as Prometheus histogram buckets).
+struct HistogramBucket {
+  double        upper {};
+  std::uint64_t count {};
+};
+
+struct SummaryQuantile {
+  double quantile {};
+  double value    {};
+};
+
 struct Metric {
   std::string kind  {};
   std::string name  {};
   std::string desc  {};
   double      value {};
+
+  // Only used by Histogram and Summary metrics, and omitted from JSON
+  // otherwise. Their value is the mean, for consumers that only understand
+  // single valued metrics.
+  std::uint64_t                count     {};
+  double                       sum       {};
+  std::vector<HistogramBucket> buckets   {};
+  std::vector<SummaryQuantile> quantiles {};
 };
 
 struct Metrics {
@@ -69,6 +89,8 @@ Envelope<T> NewEnvelope(const std::string &sender, T contents) {
     env.kind = "Status";
   } else if (std::is_same_v<T, Update>) {
     env.kind = "Update";
+  } else if (std::is_same_v<T, Confirmation>) {
+    env.kind = "Confirmation";
   } else if (std::is_same_v<T, Metrics>) {
     env.kind = "Metric";
   }
@@ -105,7 +127,50 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Point, tag, value, ts)
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Status, measurements)
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Update, updates, recipient, confirm)
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Confirmation, confirm, errors)
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Metric, kind, name, desc, value)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(HistogramBucket, upper, count)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(SummaryQuantile, quantile, value)
+
+inline void to_json(json& j, const Metric& m) {
+  j["kind"]  = m.kind;
+  j["name"]  = m.name;
+  j["desc"]  = m.desc;
+  j["value"] = m.value;
+
+  if (m.kind == "Histogram" || m.kind == "Summary") {
+    j["count"] = m.count;
+    j["sum"]   = m.sum;
+  }
+
+  if (!m.buckets.empty()) {
+    j["buckets"] = m.buckets;
+  }
+
+  if (!m.quantiles.empty()) {
+    j["quantiles"] = m.quantiles;
+  }
+}
+
+inline void from_json(const json& j, Metric& m) {
+  j.at("kind").get_to(m.kind);
+  j.at("name").get_to(m.name);
+  j.at("desc").get_to(m.desc);
+  j.at("value").get_to(m.value);
+
+  m.count = j.value("count", std::uint64_t(0));
+  m.sum   = j.value("sum", 0.0);
+
+  m.buckets.clear();
+  m.quantiles.clear();
+
+  if (j.contains("buckets") && j["buckets"].is_array()) {
+    j["buckets"].get_to(m.buckets);
+  }
+
+  if (j.contains("quantiles") && j["quantiles"].is_array()) {
+    j["quantiles"].get_to(m.quantiles);
+  }
+}
+
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Metrics, metrics)
 
 } // namespace msgbus
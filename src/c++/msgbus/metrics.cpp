@@ -1,92 +1,228 @@
+#include <algorithm>
+
 #include "metrics.hpp"
 
 namespace otsim {
 namespace msgbus {
 
-void MetricsPusher::Start(std::shared_ptr<Pusher> pusher, const std::string& name) {
-  thread = std::thread(&MetricsPusher::run, this, pusher, name);
+std::vector<double> ExponentialBuckets(double start, double factor, std::size_t count) {
+  std::vector<double> bounds;
+
+  for (std::size_t i = 0; i < count; ++i) {
+    bounds.push_back(start);
+    start *= factor;
+  }
+
+  return bounds;
 }
 
-void MetricsPusher::Stop() {
-  running.store(false);
+const std::vector<double>& DefaultLatencyBuckets() {
+  static const std::vector<double> bounds = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+  };
 
-  if (thread.joinable()) {
-    thread.join();
+  return bounds;
+}
+
+HistogramValue::HistogramValue(const std::string& kind, const std::string& name, const std::string& desc,
+  std::vector<double> bounds, std::vector<double> quantiles) :
+  kind(kind), name(name), desc(desc), bounds(bounds), quantiles(quantiles),
+  counts(new std::atomic<std::uint64_t>[bounds.size() + 1]), previous(bounds.size() + 1, 0)
+{
+  for (std::size_t i = 0; i <= bounds.size(); ++i) {
+    counts[i].store(0, std::memory_order_relaxed);
   }
 }
 
-void MetricsPusher::NewMetric(const std::string& kind, const std::string& name, const std::string& desc) {
+void HistogramValue::Observe(double val) {
+  auto i = std::lower_bound(bounds.begin(), bounds.end(), val) - bounds.begin();
+
+  counts[i].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+
+  auto cur = sum.load(std::memory_order_relaxed);
+  while (!sum.compare_exchange_weak(cur, cur + val, std::memory_order_relaxed));
+}
+
+Metric HistogramValue::Snapshot() {
   Metric metric = {
-    .kind = kind,
-    .name = name,
-    .desc = desc,
+    .kind  = kind,
+    .name  = name,
+    .desc  = desc,
+    .count = count.load(std::memory_order_relaxed),
+    .sum   = sum.load(std::memory_order_relaxed),
   };
 
-  metrics[name] = metric;
+  if (metric.count) {
+    metric.value = metric.sum / metric.count;
+  }
+
+  if (quantiles.empty()) {
+    std::uint64_t cumulative = 0;
+
+    for (std::size_t i = 0; i < bounds.size(); ++i) {
+      cumulative += counts[i].load(std::memory_order_relaxed);
+      metric.buckets.push_back(HistogramBucket{bounds[i], cumulative});
+    }
+
+    return metric;
+  }
+
+  std::vector<std::uint64_t> delta(bounds.size() + 1);
+  std::uint64_t total = 0;
+
+  for (std::size_t i = 0; i <= bounds.size(); ++i) {
+    auto current = counts[i].load(std::memory_order_relaxed);
+
+    delta[i]    = current - previous[i];
+    previous[i] = current;
+
+    total += delta[i];
+  }
+
+  if (total == 0) {
+    return metric;
+  }
+
+  for (auto q : quantiles) {
+    auto rank = q * total;
+    std::uint64_t cumulative = 0;
+
+    for (std::size_t i = 0; i <= bounds.size(); ++i) {
+      if (delta[i] == 0 || cumulative + delta[i] < rank) {
+        cumulative += delta[i];
+        continue;
+      }
+
+      double lower = i == 0 ? 0.0 : bounds[i - 1];
+      double upper = i < bounds.size() ? bounds[i] : bounds.back();
+
+      auto value = lower + (upper - lower) * ((rank - cumulative) / delta[i]);
+
+      metric.quantiles.push_back(SummaryQuantile{q, value});
+      break;
+    }
+  }
+
+  return metric;
 }
 
-void MetricsPusher::IncrMetric(const std::string &name) {
-  try {
-    auto lock = std::unique_lock<std::mutex>(metricsMu);
+void MetricsPusher::Start(std::shared_ptr<Pusher> pusher, const std::string& name) {
+  task = SharedScheduler().Every(std::chrono::seconds(5), std::bind(&MetricsPusher::push, this, pusher, name));
+}
+
+void MetricsPusher::Stop() {
+  SharedScheduler().Cancel(task);
+}
+
+MetricHandle MetricsPusher::NewMetric(const std::string& kind, const std::string& name, const std::string& desc) {
+  auto lock = std::unique_lock<std::mutex>(metricsMu);
+
+  auto iter = metrics.find(name);
+  if (iter != metrics.end()) {
+    return MetricHandle(iter->second);
+  }
+
+  values.push_back(std::make_unique<MetricValue>(kind, name, desc));
+  metrics[name] = values.back().get();
 
-    auto metric = metrics.at(name);
-    metric.value += 1.0;
+  return MetricHandle(values.back().get());
+}
 
-    metrics[name] = metric;
-  } catch(const std::out_of_range&) {}
+void MetricsPusher::IncrMetric(const std::string &name) {
+  lookup(name).Incr();
 }
 
 void MetricsPusher::IncrMetricBy(const std::string &name, int val) {
-  try {
-    auto lock = std::unique_lock<std::mutex>(metricsMu);
+  lookup(name).Incr(val);
+}
+
+void MetricsPusher::SetMetric(const std::string &name, double val) {
+  lookup(name).Set(val);
+}
+
+HistogramHandle MetricsPusher::NewHistogram(const std::string& name, const std::string& desc, const std::vector<double>& bounds) {
+  auto lock = std::unique_lock<std::mutex>(metricsMu);
+
+  auto iter = histograms.find(name);
+  if (iter != histograms.end()) {
+    return HistogramHandle(iter->second);
+  }
 
-    auto metric = metrics.at(name);
-    metric.value += val;
+  histogramValues.push_back(std::make_unique<HistogramValue>("Histogram", name, desc, bounds));
+  histograms[name] = histogramValues.back().get();
 
-    metrics[name] = metric;
-  } catch(const std::out_of_range&) {}
+  return HistogramHandle(histogramValues.back().get());
 }
 
-void MetricsPusher::SetMetric(const std::string &name, double val) {
-  try {
-    auto lock = std::unique_lock<std::mutex>(metricsMu);
+HistogramHandle MetricsPusher::NewSummary(const std::string& name, const std::string& desc, const std::vector<double>& quantiles) {
+  // 1us to ~109s, each bucket 25% wider than the last.
+  static const auto bounds = ExponentialBuckets(0.000001, 1.25, 84);
 
-    auto metric = metrics.at(name);
-    metric.value = val;
+  auto lock = std::unique_lock<std::mutex>(metricsMu);
+
+  auto iter = histograms.find(name);
+  if (iter != histograms.end()) {
+    return HistogramHandle(iter->second);
+  }
 
-    metrics[name] = metric;
-  } catch(const std::out_of_range&) {}
+  histogramValues.push_back(std::make_unique<HistogramValue>("Summary", name, desc, bounds, quantiles));
+  histograms[name] = histogramValues.back().get();
+
+  return HistogramHandle(histogramValues.back().get());
 }
 
-void MetricsPusher::run(std::shared_ptr<Pusher> pusher, const std::string& name) {
-  auto prefix = name + "_";
+MetricHandle MetricsPusher::lookup(const std::string& name) {
+  auto lock = std::unique_lock<std::mutex>(metricsMu);
+
+  auto iter = metrics.find(name);
+  if (iter == metrics.end()) {
+    return MetricHandle();
+  }
 
-  running.store(true);
+  return MetricHandle(iter->second);
+}
 
-  while (running) {
-    std::vector<Metric> updates;
+void MetricsPusher::push(std::shared_ptr<Pusher> pusher, const std::string& name) {
+  auto prefix = name + "_";
 
-    {
-      auto lock = std::unique_lock<std::mutex>(metricsMu);
+  std::vector<Metric> updates;
 
-      for (auto [name, metric] : metrics) {
-        auto copy = metric;
+  {
+    // Only blocks registering new metrics, not updating existing ones.
+    auto lock = std::unique_lock<std::mutex>(metricsMu);
 
-        auto pos = std::mismatch(prefix.begin(), prefix.end(), copy.name.begin());
-        if (pos.first != name.end()) {
-          copy.name = prefix + copy.name;
-        }
+    updates.reserve(values.size() + histogramValues.size());
 
-        updates.push_back(copy);
+    for (const auto& value : values) {
+      Metric metric = {
+        .kind  = value->kind,
+        .name  = value->name,
+        .desc  = value->desc,
+        .value = value->Value(),
+      };
+
+      if (metric.name.compare(0, prefix.size(), prefix) != 0) {
+        metric.name = prefix + metric.name;
       }
+
+      updates.push_back(std::move(metric));
     }
 
-    if (updates.size() > 0) {
-      auto env = NewEnvelope(name, Metrics{.metrics = updates});
-      pusher->Push("HEALTH", env);
+    for (const auto& value : histogramValues) {
+      auto metric = value->Snapshot();
+
+      if (metric.name.compare(0, prefix.size(), prefix) != 0) {
+        metric.name = prefix + metric.name;
+      }
+
+      updates.push_back(std::move(metric));
     }
+  }
 
-    std::this_thread::sleep_for(std::chrono::seconds(5));
+  if (updates.size() > 0) {
+    auto env = NewEnvelope(name, Metrics{.metrics = updates});
+    pusher->Push("HEALTH", env);
   }
 }
 
@@ -2,15 +2,171 @@
 #define OTSIM_MSGBUS_METRICS_HPP
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <mutex>
-#include <thread>
+#include <vector>
 
 #include "envelope.hpp"
 #include "pusher.hpp"
+#include "scheduler.hpp"
 
 namespace otsim {
 namespace msgbus {
 
+// MetricValue holds the current value of a single metric. Each one is padded
+// to its own cache line so metrics updated from different threads don't
+// contend with each other.
+class alignas(64) MetricValue {
+public:
+  MetricValue(const std::string& kind, const std::string& name, const std::string& desc) :
+    kind(kind), name(name), desc(desc), counter(kind == "Counter") {}
+
+  // Counters are incremented with a single relaxed atomic add. Gauges use a
+  // compare-and-swap loop, since atomic floating point adds require C++20.
+  void Incr(std::int64_t val = 1) {
+    if (counter) {
+      count.fetch_add(val, std::memory_order_relaxed);
+      return;
+    }
+
+    auto cur = gauge.load(std::memory_order_relaxed);
+    while (!gauge.compare_exchange_weak(cur, cur + val, std::memory_order_relaxed));
+  }
+
+  void Set(double val) {
+    if (counter) {
+      count.store(static_cast<std::int64_t>(val), std::memory_order_relaxed);
+    } else {
+      gauge.store(val, std::memory_order_relaxed);
+    }
+  }
+
+  double Value() const {
+    if (counter) {
+      return static_cast<double>(count.load(std::memory_order_relaxed));
+    }
+
+    return gauge.load(std::memory_order_relaxed);
+  }
+
+  const std::string kind;
+  const std::string name;
+  const std::string desc;
+
+private:
+  const bool counter;
+
+  std::atomic<std::int64_t> count {0};
+  std::atomic<double>       gauge {0.0};
+};
+
+// MetricHandle is returned by MetricsPusher::NewMetric and is valid for the
+// lifetime of the MetricsPusher that created it. A default constructed handle
+// ignores updates.
+class MetricHandle {
+public:
+  MetricHandle() = default;
+  MetricHandle(MetricValue* value) : value(value) {}
+
+  void Incr(std::int64_t val = 1) { if (value) value->Incr(val); }
+  void Set(double val)            { if (value) value->Set(val); }
+
+  explicit operator bool() const { return value != nullptr; }
+
+private:
+  MetricValue* value {};
+};
+
+// Returns count bucket upper bounds, starting at start and growing by factor.
+std::vector<double> ExponentialBuckets(double start, double factor, std::size_t count);
+
+// Default histogram buckets for latencies in seconds, from 100us to 10s.
+const std::vector<double>& DefaultLatencyBuckets();
+
+// HistogramValue counts observations in a fixed array of buckets, so recording
+// an observation is a binary search plus a couple of relaxed atomic updates.
+//
+// Summaries are histograms with fine-grained exponential buckets; their
+// quantiles are estimated by interpolating within buckets, using only the
+// observations made since the previous snapshot so they reflect recent tail
+// latency rather than being diluted by every observation ever made.
+class alignas(64) HistogramValue {
+public:
+  HistogramValue(const std::string& kind, const std::string& name, const std::string& desc,
+    std::vector<double> bounds, std::vector<double> quantiles = {});
+
+  void Observe(double val);
+
+  // Buckets are read individually, so a snapshot taken while observations are
+  // being made may be off by a few observations. Only one thread should take
+  // snapshots, since summaries track the previous snapshot.
+  Metric Snapshot();
+
+  const std::string kind;
+  const std::string name;
+  const std::string desc;
+
+private:
+  const std::vector<double> bounds;
+  const std::vector<double> quantiles;
+
+  // One more than bounds, for observations greater than the largest bound.
+  std::unique_ptr<std::atomic<std::uint64_t>[]> counts;
+
+  std::atomic<std::uint64_t> count {0};
+  std::atomic<double>        sum   {0.0};
+
+  // Bucket counts as of the previous snapshot (summaries only).
+  std::vector<std::uint64_t> previous;
+};
+
+// ScopedTimer observes the time (in seconds) between its creation and
+// destruction.
+class ScopedTimer {
+public:
+  ScopedTimer(HistogramValue* value) : value(value), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    if (value) {
+      value->Observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+  HistogramValue* value;
+  std::chrono::steady_clock::time_point start;
+};
+
+// HistogramHandle is returned by MetricsPusher::NewHistogram and NewSummary and
+// is valid for the lifetime of the MetricsPusher that created it. A default
+// constructed handle ignores observations.
+class HistogramHandle {
+public:
+  HistogramHandle() = default;
+  HistogramHandle(HistogramValue* value) : value(value) {}
+
+  void Observe(double val) { if (value) value->Observe(val); }
+
+  template<typename Rep, typename Period>
+  void Observe(std::chrono::duration<Rep, Period> d) {
+    Observe(std::chrono::duration<double>(d).count());
+  }
+
+  // Returns a timer that observes the duration of the enclosing scope.
+  [[nodiscard]] ScopedTimer Time() { return ScopedTimer(value); }
+
+  explicit operator bool() const { return value != nullptr; }
+
+private:
+  HistogramValue* value {};
+};
+
 class MetricsPusher {
 public:
   static std::shared_ptr<MetricsPusher> Create() {
@@ -20,18 +176,43 @@ public:
   void Start(std::shared_ptr<Pusher> pusher, const std::string& name);
   void Stop();
 
-  void NewMetric(const std::string& kind, const std::string& name, const std::string& desc);
+  // Registers a new metric, returning a handle that can be used to update it
+  // without any locking or lookups. Registering a metric with the same name
+  // as an existing one returns the existing handle.
+  MetricHandle NewMetric(const std::string& kind, const std::string& name, const std::string& desc);
+
+  // Registers a histogram with the given bucket upper bounds (sorted). As with
+  // NewMetric, an existing handle is returned if the name is already in use.
+  HistogramHandle NewHistogram(const std::string& name, const std::string& desc,
+    const std::vector<double>& bounds = DefaultLatencyBuckets());
+
+  // Registers a summary reporting the given quantiles (0.0 - 1.0) of values
+  // observed between pushes. Values are assumed to be latencies in seconds
+  // from 1us to ~100s; values outside that range are clamped.
+  HistogramHandle NewSummary(const std::string& name, const std::string& desc,
+    const std::vector<double>& quantiles = {0.5, 0.9, 0.99, 0.999});
+
+  // Updating metrics by name requires a lookup; prefer holding on to the
+  // handle returned by NewMetric.
   void IncrMetric(const std::string& name);
   void IncrMetricBy(const std::string& name, int val);
   void SetMetric(const std::string& name, double val);
 
 private:
-  void run(std::shared_ptr<Pusher> pusher, const std::string& name);
+  MetricHandle lookup(const std::string& name);
+  void push(std::shared_ptr<Pusher> pusher, const std::string& name);
+
+  // Metrics are pushed every 5 seconds by the shared scheduler.
+  Scheduler::TaskID task {};
+
+  // Values are never removed, so handles remain valid. The mutex only guards
+  // registering and looking up metrics, never updating their values.
+  std::vector<std::unique_ptr<MetricValue>> values;
+  std::map<std::string, MetricValue*> metrics;
 
-  std::atomic<bool> running;
-  std::thread thread;
+  std::vector<std::unique_ptr<HistogramValue>> histogramValues;
+  std::map<std::string, HistogramValue*> histograms;
 
-  std::map<std::string, Metric> metrics;
   std::mutex metricsMu;
 };
 
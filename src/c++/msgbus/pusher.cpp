@@ -1,19 +1,151 @@
+#include <iostream>
+
 #include "pusher.hpp"
 
 namespace otsim {
 namespace msgbus {
 
-Pusher::Pusher(const std::string& endpoint) {
-  socket = zmq::socket_t(ctx, ZMQ_PUSH);
+QueuePolicy ParseQueuePolicy(const std::string& name) {
+  if (name == "block") {
+    return QueuePolicy::Block;
+  }
+
+  if (name == "drop") {
+    return QueuePolicy::Drop;
+  }
+
+  throw std::invalid_argument("unknown message bus queue policy " + name);
+}
+
+Pusher::Pusher(const std::string& endpoint, PusherConfig config) : config(config), queue(config.queueSize) {
+  socket = zmq::socket_t(Context(), ZMQ_PUSH);
 
   socket.connect(endpoint);
   socket.set(zmq::sockopt::linger, 0);
+
+  running.store(true);
+  thread = std::thread(&Pusher::run, this);
 }
 
 Pusher::~Pusher() {
+  running.store(false);
+
+  {
+    std::lock_guard<std::mutex> lock(waitMu);
+  }
+
+  waitCV.notify_one();
+
+  {
+    std::lock_guard<std::mutex> lock(spaceMu);
+  }
+
+  spaceCV.notify_all();
+
+  if (thread.joinable()) {
+    thread.join();
+  }
+
   socket.close();
-  ctx.close();
+}
+
+bool Pusher::enqueue(const std::string& topic, const std::string& payload) {
+  Message msg = {zmq::message_t(topic), zmq::message_t(payload)};
+
+  while (!queue.TryPush(msg)) {
+    if (config.queuePolicy == QueuePolicy::Drop || !running) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    // The I/O thread only notifies when a producer is blocked. The timeout
+    // covers a pop that happens between the failed push and the wait.
+    blocked.fetch_add(1);
+
+    {
+      std::unique_lock<std::mutex> lock(spaceMu);
+      spaceCV.wait_for(lock, std::chrono::milliseconds(100));
+    }
+
+    blocked.fetch_sub(1);
+  }
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (waiting.load()) {
+    {
+      std::lock_guard<std::mutex> lock(waitMu);
+    }
+
+    waitCV.notify_one();
+  }
+
+  return true;
+}
+
+void Pusher::run() {
+  Message msg;
+
+  while (true) {
+    if (queue.TryPop(msg)) {
+      if (blocked.load()) {
+        {
+          std::lock_guard<std::mutex> lock(spaceMu);
+        }
+
+        spaceCV.notify_all();
+      }
+
+      send(msg);
+      continue;
+    }
+
+    // Only exit once the queue has been drained.
+    if (!running) {
+      break;
+    }
+
+    // Producers only notify when waiting is set, keeping the common path free
+    // of locks. The queue is checked again under the lock after setting it so
+    // a message pushed in between isn't missed.
+    waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    {
+      std::unique_lock<std::mutex> lock(waitMu);
+      waitCV.wait_for(lock, std::chrono::milliseconds(100), [this]() { return !queue.Empty() || !running; });
+    }
+
+    waiting.store(false);
+  }
+}
+
+void Pusher::send(Message& msg) {
+  try {
+    if (!sendFrame(msg.topic, zmq::send_flags::sndmore) || !sendFrame(msg.payload, zmq::send_flags::none)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  } catch (const zmq::error_t& e) {
+    std::cerr << "[msgbus] error sending message: " << e.what() << std::endl;
+  }
+}
+
+// Sends without blocking in ZMQ, retrying while the socket is at its high
+// water mark (such as when the broker is down). Gives up, returning false, if
+// the pusher is stopped in the meantime.
+bool Pusher::sendFrame(zmq::message_t& frame, zmq::send_flags flags) {
+  while (true) {
+    if (socket.send(frame, flags | zmq::send_flags::dontwait)) {
+      return true;
+    }
+
+    if (!running) {
+      return false;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
 }
 
 } // namespace msgbus
-} // namespace otsim
\ No newline at end of file
+} // namespace otsim
@@ -2,43 +2,100 @@
 #define OTSIM_MSGBUS_PUSHER_HPP
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
 
+#include "codec.hpp"
+#include "context.hpp"
 #include "envelope.hpp"
+#include "queue.hpp"
+#include "trace.hpp"
 #include "cppzmq/zmq.hpp"
-#include "nlohmann/json.hpp"
-
-using json = nlohmann::json;
 
 namespace otsim {
 namespace msgbus {
 
+// What to do when pushing a message while the send queue is full.
+enum class QueuePolicy { Block, Drop };
+
+// Parses "block" or "drop". Throws std::invalid_argument for anything else.
+QueuePolicy ParseQueuePolicy(const std::string& name);
+
+struct PusherConfig {
+  Encoding encoding = Encoding::JSON;
+
+  std::size_t queueSize   = 4096;
+  QueuePolicy queuePolicy = QueuePolicy::Block;
+};
+
+// Pusher is safe to use from multiple threads. Envelopes are encoded on the
+// calling thread and placed on a bounded, lock-free send queue that is drained
+// by a dedicated I/O thread, which is the only thread to ever touch the ZMQ
+// socket. Callers only ever block if the send queue is full and the queue
+// policy is QueuePolicy::Block, and then sleep until there's room rather than
+// spinning. The I/O thread never blocks in ZMQ, so a Pusher can always be
+// destroyed, even when the broker is down.
 class Pusher {
 public:
-  static std::shared_ptr<Pusher> Create(const std::string& endpoint) {
-    return std::make_shared<Pusher>(endpoint);
+  static std::shared_ptr<Pusher> Create(const std::string& endpoint, PusherConfig config = {}) {
+    return std::make_shared<Pusher>(endpoint, config);
   }
 
-  Pusher(const std::string& endpoint);
+  Pusher(const std::string& endpoint, PusherConfig config = {});
   ~Pusher();
 
+  // Returns false if the message was dropped because the send queue was full.
   template<typename T> // must be implemented in header file since it's templated
-  void Push(const std::string& topic, const Envelope<T>& env) {
-    json j = env;
+  bool Push(const std::string& topic, const Envelope<T>& env) {
+    if (Tracing()) {
+      auto traced = env;
+      TracePublish(traced.metadata);
 
-    std::stringstream msg;
-    msg << j;
+      return enqueue(topic, Encode(traced, config.encoding));
+    }
 
-    socket.send(zmq::message_t(topic), zmq::send_flags::sndmore);
-    socket.send(zmq::message_t(msg.str()), zmq::send_flags::none);
+    return enqueue(topic, Encode(env, config.encoding));
   }
 
+  // Number of messages dropped due to the send queue being full.
+  std::uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
 private:
-  zmq::context_t ctx;
+  struct Message {
+    zmq::message_t topic;
+    zmq::message_t payload;
+  };
+
+  bool enqueue(const std::string& topic, const std::string& payload);
+  void run();
+  void send(Message& msg);
+  bool sendFrame(zmq::message_t& frame, zmq::send_flags flags);
+
+  PusherConfig config;
+
   zmq::socket_t socket;
+
+  BoundedQueue<Message> queue;
+  std::atomic<std::uint64_t> dropped {0};
+
+  std::atomic<bool> running;
+  std::thread thread;
+
+  // Used to put the I/O thread to sleep when the send queue is empty.
+  std::atomic<bool> waiting {false};
+  std::mutex waitMu;
+  std::condition_variable waitCV;
+
+  // Used to put producers to sleep when the send queue is full, until the I/O
+  // thread makes room.
+  std::atomic<int> blocked {0};
+  std::mutex spaceMu;
+  std::condition_variable spaceCV;
 };
 
 } // namespace msgbus
 } // namespace otsim
 
-#endif // OTSIM_MSGBUS_PUSHER_HPP
\ No newline at end of file
+#endif // OTSIM_MSGBUS_PUSHER_HPP
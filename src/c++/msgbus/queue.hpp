@@ -0,0 +1,119 @@
+#ifndef OTSIM_MSGBUS_QUEUE_HPP
+#define OTSIM_MSGBUS_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace otsim {
+namespace msgbus {
+
+// BoundedQueue is a fixed capacity, lock-free queue safe for use by multiple
+// producers and multiple consumers (Dmitry Vyukov's bounded MPMC queue). The
+// capacity is rounded up to the next power of two.
+template<typename T>
+class BoundedQueue {
+public:
+  BoundedQueue(std::size_t capacity) {
+    std::size_t size = 2;
+
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    cells.reset(new Cell[size]);
+    mask = size - 1;
+
+    for (std::size_t i = 0; i < size; ++i) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  std::size_t Capacity() const { return mask + 1; }
+
+  // Only a snapshot; another thread may push or pop immediately after.
+  bool Empty() const {
+    auto pos = head.load(std::memory_order_relaxed);
+    return cells[pos & mask].seq.load(std::memory_order_acquire) != pos + 1;
+  }
+
+  // Returns false without modifying value if the queue is full.
+  bool TryPush(T& value) {
+    Cell* cell;
+    auto pos = tail.load(std::memory_order_relaxed);
+
+    while (true) {
+      cell = &cells[pos & mask];
+
+      auto seq  = cell->seq.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Returns false without modifying value if the queue is empty.
+  bool TryPop(T& value) {
+    Cell* cell;
+    auto pos = head.load(std::memory_order_relaxed);
+
+    while (true) {
+      cell = &cells[pos & mask];
+
+      auto seq  = cell->seq.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = std::move(cell->data);
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<std::size_t> seq;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  std::size_t mask;
+
+  // Keep producer and consumer positions on separate cache lines.
+  alignas(64) std::atomic<std::size_t> head;
+  alignas(64) std::atomic<std::size_t> tail;
+};
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_QUEUE_HPP
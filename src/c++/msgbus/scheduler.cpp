@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include "scheduler.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+Scheduler::Scheduler(std::size_t count) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(count, 1); ++i) {
+    workers.push_back(std::thread(&Scheduler::run, this));
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    auto lock = std::unique_lock<std::mutex>(mu);
+    stopping = true;
+  }
+
+  queueCV.notify_all();
+
+  for (auto& worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+Scheduler::TaskID Scheduler::After(Clock::duration delay, std::function<void()> task) {
+  return schedule(Clock::now() + delay, Clock::duration::zero(), task);
+}
+
+Scheduler::TaskID Scheduler::Every(Clock::duration interval, std::function<void()> task) {
+  return schedule(Clock::now(), interval, task);
+}
+
+void Scheduler::Cancel(TaskID id) {
+  auto lock = std::unique_lock<std::mutex>(mu);
+
+  auto iter = tasks.find(id);
+  if (iter == tasks.end()) {
+    return;
+  }
+
+  if (!iter->second.running) {
+    // Its queue entry is skipped when it comes due.
+    tasks.erase(iter);
+    return;
+  }
+
+  // The worker running the task removes it once it completes.
+  iter->second.canceled = true;
+
+  if (iter->second.runner == std::this_thread::get_id()) {
+    return;
+  }
+
+  doneCV.wait(lock, [this, id]() { return !tasks.count(id); });
+}
+
+Scheduler::TaskID Scheduler::schedule(Clock::time_point when, Clock::duration interval, std::function<void()> task) {
+  TaskID id;
+
+  {
+    auto lock = std::unique_lock<std::mutex>(mu);
+
+    id = nextID++;
+
+    tasks[id] = Task{task, interval};
+    queue.push(Entry{when, id});
+  }
+
+  queueCV.notify_one();
+
+  return id;
+}
+
+void Scheduler::run() {
+  auto lock = std::unique_lock<std::mutex>(mu);
+
+  while (!stopping) {
+    if (queue.empty()) {
+      queueCV.wait(lock);
+      continue;
+    }
+
+    auto entry = queue.top();
+
+    if (Clock::now() < entry.when) {
+      queueCV.wait_until(lock, entry.when);
+      continue;
+    }
+
+    queue.pop();
+
+    auto iter = tasks.find(entry.id);
+    if (iter == tasks.end()) {
+      continue; // canceled
+    }
+
+    iter->second.running = true;
+    iter->second.runner  = std::this_thread::get_id();
+
+    // Safe to use without the lock held, since tasks are never removed while
+    // running (see Cancel).
+    auto& fn = iter->second.fn;
+
+    lock.unlock();
+
+    try {
+      fn();
+    } catch (const std::exception& e) {
+      std::cerr << "ERROR: scheduled task failed: " << e.what() << std::endl;
+    }
+
+    lock.lock();
+
+    // Tasks scheduled while this one ran may have caused a rehash, which
+    // invalidates iterators (but not references).
+    iter = tasks.find(entry.id);
+
+    auto& task = iter->second;
+    task.running = false;
+
+    if (task.canceled || task.interval == Clock::duration::zero()) {
+      tasks.erase(iter);
+    } else {
+      auto next = entry.when + task.interval;
+      auto now  = Clock::now();
+
+      if (next < now) {
+        next = now + task.interval;
+      }
+
+      queue.push(Entry{next, entry.id});
+      queueCV.notify_one();
+    }
+
+    doneCV.notify_all();
+  }
+}
+
+namespace {
+
+std::mutex sharedMu;
+std::size_t sharedWorkers = 0;
+std::unique_ptr<Scheduler> shared;
+
+} // namespace
+
+bool ConfigureScheduler(std::size_t workers) {
+  auto lock = std::unique_lock<std::mutex>(sharedMu);
+
+  if (shared) {
+    return false;
+  }
+
+  sharedWorkers = workers;
+  return true;
+}
+
+Scheduler& SharedScheduler() {
+  auto lock = std::unique_lock<std::mutex>(sharedMu);
+
+  if (!shared) {
+    auto workers = sharedWorkers;
+
+    if (workers == 0) {
+      workers = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    shared.reset(new Scheduler(workers));
+  }
+
+  return *shared;
+}
+
+} // namespace msgbus
+} // namespace otsim
@@ -0,0 +1,95 @@
+#ifndef OTSIM_MSGBUS_SCHEDULER_HPP
+#define OTSIM_MSGBUS_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace otsim {
+namespace msgbus {
+
+// Scheduler runs one-shot and periodic tasks on a small, fixed pool of worker
+// threads, so periodic work (applying points, pushing metrics, heartbeats) and
+// delays (restart timers) don't each need a dedicated, mostly sleeping thread.
+//
+// Tasks should not block for long, since doing so ties up a worker and delays
+// every other task due to run. A periodic task never runs concurrently with
+// itself; if it overruns its interval, the next run is scheduled relative to
+// when it finished rather than running back-to-back to catch up.
+class Scheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::uint64_t TaskID;
+
+  Scheduler(std::size_t workers);
+  ~Scheduler();
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Runs task once, after the given delay.
+  TaskID After(Clock::duration delay, std::function<void()> task);
+
+  // Runs task immediately and then every interval until canceled.
+  TaskID Every(Clock::duration interval, std::function<void()> task);
+
+  // Cancels a task. If the task is currently running, blocks until it
+  // completes unless called from the task itself. Canceling a task that has
+  // already completed (or was never scheduled) is a no-op.
+  void Cancel(TaskID id);
+
+  std::size_t Workers() const { return workers.size(); }
+
+private:
+  struct Entry {
+    Clock::time_point when;
+    TaskID id;
+
+    bool operator>(const Entry& other) const { return when > other.when; }
+  };
+
+  struct Task {
+    std::function<void()> fn;
+    Clock::duration interval;
+
+    bool running  {};
+    bool canceled {};
+
+    std::thread::id runner;
+  };
+
+  TaskID schedule(Clock::time_point when, Clock::duration interval, std::function<void()> task);
+  void run();
+
+  std::mutex mu;
+  std::condition_variable queueCV; // signaled when tasks are scheduled
+  std::condition_variable doneCV;  // signaled when tasks finish running
+
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  std::unordered_map<TaskID, Task> tasks;
+
+  TaskID nextID = 1;
+  bool stopping {};
+
+  std::vector<std::thread> workers;
+};
+
+// Sets the number of worker threads used by the scheduler shared by the
+// process. Returns false if the shared scheduler has already been created, in
+// which case the setting is ignored.
+bool ConfigureScheduler(std::size_t workers);
+
+// Returns the scheduler shared by the process, creating it the first time it's
+// called. Defaults to one worker per hardware thread, up to four.
+Scheduler& SharedScheduler();
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_SCHEDULER_HPP
@@ -1,30 +1,35 @@
-#include "subscriber.hpp"
-#include "nlohmann/json.hpp"
+#include <iostream>
 
-using json = nlohmann::json;
+#include "subscriber.hpp"
+#include "trace.hpp"
 
 namespace otsim {
 namespace msgbus {
 
 Subscriber::Subscriber(const std::string& endpoint) {
-  socket = zmq::socket_t(ctx, ZMQ_SUB);
+  socket = zmq::socket_t(Context(), ZMQ_SUB);
 
   socket.connect(endpoint);
   socket.set(zmq::sockopt::linger, 0);
+
+  // The context is shared by the whole process, so it can't be shut down to
+  // interrupt a blocking receive when stopping. Time out periodically instead
+  // so the running flag gets checked.
+  socket.set(zmq::sockopt::rcvtimeo, 100);
 }
 
 Subscriber::~Subscriber() {
+  Stop();
   socket.close();
-  ctx.close();
 }
 
 void Subscriber::Start(const std::string& topic) {
+  running.store(true);
   thread = std::thread(&Subscriber::run, this, topic);
 }
 
 void Subscriber::Stop() {
   running.store(false);
-  ctx.shutdown();
 
   if (thread.joinable()) {
     thread.join();
@@ -34,7 +39,12 @@ void Subscriber::Stop() {
 void Subscriber::run(const std::string& topic) {
   socket.set(zmq::sockopt::subscribe, topic);
 
-  running.store(true);
+  // Subscribe before requesting a snapshot so nothing published in between
+  // is missed. Anything published since the snapshot was taken will be
+  // handled after it, so handlers still end up with the latest values.
+  if (!snapshotEndpoint.empty()) {
+    snapshot(topic);
+  }
 
   while (running) {
     zmq::message_t t;
@@ -50,7 +60,7 @@ void Subscriber::run(const std::string& topic) {
     }
 
     // This shouldn't ever really happen...
-    if (t.to_string() != topic) {
+    if (t.to_string_view() != topic) {
       continue;
     }
 
@@ -65,25 +75,78 @@ void Subscriber::run(const std::string& topic) {
       continue;
     }
 
-    std::stringstream str(msg.to_string());
+    handle(msg.data(), msg.size());
+  }
+}
 
-    json j;
-    str >> j;
+void Subscriber::snapshot(const std::string& topic) {
+  zmq::socket_t req(Context(), ZMQ_REQ);
 
-    if (j["kind"] == "Status") {
-      auto env = j.get<Envelope<Status>>();
+  req.set(zmq::sockopt::linger, 0);
+  req.set(zmq::sockopt::rcvtimeo, 5000);
 
-      for (auto &handler : statusHandlers) {
-        handler(env);
+  req.connect(snapshotEndpoint);
+
+  std::vector<zmq::message_t> reply;
+
+  try {
+    req.send(zmq::message_t("SNAPSHOT", 8), zmq::send_flags::sndmore);
+    req.send(zmq::message_t(topic.data(), topic.size()), zmq::send_flags::none);
+
+    do {
+      zmq::message_t frame;
+
+      auto ret = req.recv(frame);
+      if (!ret.has_value()) {
+        std::cerr << "[msgbus] timed out requesting snapshot from " << snapshotEndpoint << std::endl;
+        return;
       }
+
+      reply.push_back(std::move(frame));
+    } while (reply.back().more());
+  } catch (zmq::error_t& e) {
+    std::cerr << "[msgbus] unable to request snapshot from " << snapshotEndpoint << ": " << e.what() << std::endl;
+    return;
+  }
+
+  if (reply.empty() || reply[0].to_string_view() != "SNAPSHOT") {
+    std::cerr << "[msgbus] invalid snapshot reply from " << snapshotEndpoint << std::endl;
+    return;
+  }
+
+  // The rest of the reply is pairs of topic and envelope frames.
+  for (std::size_t i = 1; i + 1 < reply.size(); i += 2) {
+    if (reply[i].to_string_view() != topic) {
+      continue;
     }
 
-    if (j["kind"] == "Update") {
-      auto env = j.get<Envelope<Update>>();
+    handle(reply[i + 1].data(), reply[i + 1].size());
+  }
+}
 
-      for (auto &handler : updateHandlers) {
-        handler(env);
-      }
+void Subscriber::handle(const void* data, std::size_t size) {
+  std::string kind;
+
+  try {
+    kind = decoder.Decode(data, size);
+  } catch (const DecodeError& e) {
+    std::cerr << "[msgbus] dropping malformed envelope: " << e.what() << std::endl;
+    return;
+  }
+
+  if (kind == "Status") {
+    TraceReceive(decoder.StatusEnvelope().metadata, kind);
+
+    for (auto &handler : statusHandlers) {
+      handler(decoder.StatusEnvelope());
+    }
+  }
+
+  if (kind == "Update") {
+    TraceReceive(decoder.UpdateEnvelope().metadata, kind);
+
+    for (auto &handler : updateHandlers) {
+      handler(decoder.UpdateEnvelope());
     }
   }
 }
@@ -5,6 +5,8 @@
 #include <functional>
 #include <thread>
 
+#include "context.hpp"
+#include "decoder.hpp"
 #include "envelope.hpp"
 #include "cppzmq/zmq.hpp"
 
@@ -31,15 +33,25 @@ public:
     updateHandlers.push_back(handler);
   }
 
+  // If set, a snapshot of the broker's last-value cache for the topic is
+  // requested from the given endpoint when starting, and handled before any
+  // newly published envelopes. Must be called before Start.
+  void SetSnapshotEndpoint(const std::string& endpoint) { snapshotEndpoint = endpoint; }
+
   void Start(const std::string& topic);
   void Stop();
 
 private:
   void run(const std::string& topic);
+  void snapshot(const std::string& topic);
+  void handle(const void* data, std::size_t size);
 
-  zmq::context_t ctx;
   zmq::socket_t socket;
 
+  Decoder decoder;
+
+  std::string snapshotEndpoint;
+
   std::atomic<bool> running;
   std::thread thread;
 
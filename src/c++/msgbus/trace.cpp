@@ -0,0 +1,157 @@
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+#include <unistd.h>
+
+#include "trace.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+const char* TRACE_ID        = "trace-id";
+const char* TRACE_PUBLISHED = "trace-published-us";
+const char* TRACE_RECEIVED  = "trace-received-us";
+
+namespace detail {
+std::atomic<bool> tracing {false};
+}
+
+namespace {
+
+std::mutex fileMu;
+std::FILE* file = nullptr;
+bool first = true;
+
+std::atomic<std::uint64_t> nextID {1};
+std::atomic<std::uint32_t> nextThread {1};
+
+// Chrome trace events need a numeric thread ID; small sequential ones keep the
+// trace viewer readable.
+std::uint32_t threadID() {
+  thread_local std::uint32_t id = nextThread.fetch_add(1, std::memory_order_relaxed);
+  return id;
+}
+
+void write(const json& event) {
+  auto line = event.dump();
+
+  auto lock = std::unique_lock<std::mutex>(fileMu);
+
+  if (!file) {
+    return;
+  }
+
+  std::fputs(first ? "[\n" : ",\n", file);
+  std::fputs(line.c_str(), file);
+
+  first = false;
+}
+
+} // namespace
+
+bool StartTracing(const std::string& path) {
+  auto lock = std::unique_lock<std::mutex>(fileMu);
+
+  if (file) {
+    return true;
+  }
+
+  file = std::fopen(path.c_str(), "w");
+
+  if (!file) {
+    return false;
+  }
+
+  first = true;
+  detail::tracing.store(true);
+
+  return true;
+}
+
+void StopTracing() {
+  detail::tracing.store(false);
+
+  auto lock = std::unique_lock<std::mutex>(fileMu);
+
+  if (!file) {
+    return;
+  }
+
+  std::fputs(first ? "[]\n" : "\n]\n", file);
+  std::fclose(file);
+
+  file = nullptr;
+}
+
+std::uint64_t TraceNow() {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+std::string NewTraceID(const std::string& sender) {
+  return sender + ":" + std::to_string(getpid()) + ":" + std::to_string(nextID.fetch_add(1, std::memory_order_relaxed));
+}
+
+void TracePublish(Metadata& metadata) {
+  if (!Tracing()) {
+    return;
+  }
+
+  if (!metadata.count(TRACE_ID)) {
+    auto sender = metadata.count("sender") ? metadata["sender"] : "unknown";
+    metadata[TRACE_ID] = NewTraceID(sender);
+  }
+
+  metadata[TRACE_PUBLISHED] = std::to_string(TraceNow());
+}
+
+void TraceReceive(Metadata& metadata, const std::string& kind) {
+  if (!Tracing()) {
+    return;
+  }
+
+  auto now = TraceNow();
+  metadata[TRACE_RECEIVED] = std::to_string(now);
+
+  auto published = TraceTimestamp(metadata, TRACE_PUBLISHED);
+
+  if (published && metadata.count(TRACE_ID)) {
+    TraceSpan("msgbus " + kind, metadata[TRACE_ID], published, now);
+  }
+}
+
+void TraceSpan(const std::string& name, const std::string& id, std::uint64_t start, std::uint64_t end) {
+  if (!Tracing()) {
+    return;
+  }
+
+  json event = {
+    {"name", name},
+    {"cat",  "ot-sim"},
+    {"ph",   "X"},
+    {"ts",   start},
+    {"dur",  end > start ? end - start : 0},
+    {"pid",  getpid()},
+    {"tid",  threadID()},
+    {"args", {{"trace-id", id}}},
+  };
+
+  write(event);
+}
+
+std::uint64_t TraceTimestamp(const Metadata& metadata, const char* key) {
+  auto iter = metadata.find(key);
+  if (iter == metadata.end()) {
+    return 0;
+  }
+
+  try {
+    return std::stoull(iter->second);
+  } catch (const std::logic_error&) {
+    return 0;
+  }
+}
+
+} // namespace msgbus
+} // namespace otsim
@@ -0,0 +1,59 @@
+#ifndef OTSIM_MSGBUS_TRACE_HPP
+#define OTSIM_MSGBUS_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "envelope.hpp"
+
+namespace otsim {
+namespace msgbus {
+
+// Envelope metadata keys used when tracing is enabled. Timestamps are
+// microseconds since the Unix epoch, so spans recorded by different processes
+// on the same host line up.
+extern const char* TRACE_ID;
+extern const char* TRACE_PUBLISHED;
+extern const char* TRACE_RECEIVED;
+
+namespace detail {
+extern std::atomic<bool> tracing;
+}
+
+// Starts writing spans to the given file in Chrome's trace event format
+// (viewable in chrome://tracing or Perfetto). Returns false if the file can't
+// be opened.
+bool StartTracing(const std::string& path);
+
+// Stops tracing and closes the trace file.
+void StopTracing();
+
+// Tracing is off by default, and all the functions below are no-ops unless
+// it has been started. Check this first to avoid doing any tracing work.
+inline bool Tracing() { return detail::tracing.load(std::memory_order_relaxed); }
+
+// Current time in microseconds since the Unix epoch.
+std::uint64_t TraceNow();
+
+// Returns a new trace ID unique to this process, prefixed with the sender.
+std::string NewTraceID(const std::string& sender);
+
+// Stamps an envelope about to be published with its publish time, assigning
+// it a trace ID if it doesn't already have one.
+void TracePublish(Metadata& metadata);
+
+// Stamps a received envelope with its receive time and records a span from
+// when it was published (if it was traced when published).
+void TraceReceive(Metadata& metadata, const std::string& kind);
+
+// Records a span covering [start, end) for the given trace ID.
+void TraceSpan(const std::string& name, const std::string& id, std::uint64_t start, std::uint64_t end);
+
+// Returns the value of the given metadata timestamp, or zero if missing.
+std::uint64_t TraceTimestamp(const Metadata& metadata, const char* key);
+
+} // namespace msgbus
+} // namespace otsim
+
+#endif // OTSIM_MSGBUS_TRACE_HPP
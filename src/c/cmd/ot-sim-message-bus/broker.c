@@ -0,0 +1,578 @@
+#include <inttypes.h>
+
+#include "broker.h"
+#include "envelope.h"
+#include "recording.h"
+#include "shard.h"
+
+// Senders longer than this are truncated when sharding by sender.
+#define MAX_SENDER 256
+
+// How long to wait for every shard to reply to a snapshot request before
+// replying with whatever has been collected so far.
+#define SNAPSHOT_TIMEOUT 1000
+
+// A snapshot request waiting on replies from the shards.
+typedef struct {
+  uint64_t seq;
+  int remaining;
+  int64_t deadline;
+
+  // Reply being built, starting with the requester's identity.
+  zmsg_t *reply;
+} pending_snapshot_t;
+
+struct _broker_t {
+  config *c;
+
+  zsock_t *frontend;
+  zsock_t *snapshot;
+
+  // With a single shard, the broker owns the PUB socket and processes every
+  // message itself. With more, it only routes messages to the shards and the
+  // backend actor owns the PUB socket.
+  zsock_t *backend;
+  zactor_t *publisher;
+
+  zactor_t *recorder;
+
+  int count;
+  shard_t **shards;
+  zactor_t **actors;
+  zsock_t **routes;
+
+  // Snapshot requests sent to the shards, oldest first. Shard replies are
+  // collected in the main poll loop rather than blocking on each shard, and
+  // are tagged with the request's sequence number so replies arriving after
+  // their request timed out are discarded instead of answering a later one.
+  zlist_t *snapshots;
+  uint64_t seq;
+
+  // Used to publish metrics. Either the backend socket or a PUSH socket to
+  // the publisher.
+  zsock_t *out;
+
+  // Totals as of the last time stats were reported.
+  uint64_t *messages;
+  uint64_t *bytes;
+  uint64_t *conflated;
+  uint64_t *unrecorded;
+  int64_t reported;
+};
+
+// The backend actor publishes everything sent to SHARD_BACKEND_ENDPOINT on
+// the PUB socket passed as its argument, which it takes ownership of.
+static void backend_actor(zsock_t *pipe, void *args) {
+  zsock_t *pub = (zsock_t *) args;
+  zsock_t *in  = zsock_new_pull(SHARD_BACKEND_ENDPOINT);
+
+  assert(in);
+
+  zsock_signal(pipe, 0);
+
+  zpoller_t *poller = zpoller_new(pipe, in, NULL);
+
+  while (1) {
+    void *which = zpoller_wait(poller, -1);
+
+    if (which == in) {
+      zmsg_t *msg = zmsg_recv(in);
+
+      if (msg) {
+        zmsg_send(&msg, pub);
+      }
+    } else if (which == pipe) {
+      break; // only ever sent $TERM
+    } else if (zpoller_terminated(poller)) {
+      break;
+    }
+  }
+
+  zpoller_destroy(&poller);
+
+  zsock_destroy(&in);
+  zsock_destroy(&pub);
+}
+
+static void broker_destroy(broker_t **self_p) {
+  assert(self_p);
+
+  if (*self_p) {
+    broker_t *self = *self_p;
+
+    zsock_destroy(&self->frontend);
+    zsock_destroy(&self->snapshot);
+
+    // Shards send to the publisher, so stop them first.
+    for (int i = 0; i < self->count; i++) {
+      if (self->actors) {
+        zactor_destroy(&self->actors[i]);
+        zsock_destroy(&self->routes[i]);
+      }
+
+      shard_destroy(&self->shards[i]);
+    }
+
+    if (self->out != self->backend) {
+      zsock_destroy(&self->out);
+    }
+
+    // Also stopped after the shards so it records everything they send.
+    zactor_destroy(&self->recorder);
+
+    zactor_destroy(&self->publisher);
+    zsock_destroy(&self->backend);
+
+    if (self->snapshots) {
+      for (pending_snapshot_t *p = zlist_pop(self->snapshots); p != NULL; p = zlist_pop(self->snapshots)) {
+        zmsg_destroy(&p->reply);
+        free(p);
+      }
+
+      zlist_destroy(&self->snapshots);
+    }
+
+    free(self->shards);
+    free(self->actors);
+    free(self->routes);
+    free(self->messages);
+    free(self->bytes);
+    free(self->conflated);
+    free(self->unrecorded);
+
+    free(self);
+    *self_p = NULL;
+  }
+}
+
+static int broker_init(broker_t *self) {
+  config *c = self->c;
+
+  self->count = c->shards > 1 ? c->shards : 1;
+
+  self->shards   = (shard_t **) zmalloc(self->count * sizeof(shard_t *));
+  self->messages = (uint64_t *) zmalloc(self->count * sizeof(uint64_t));
+  self->bytes    = (uint64_t *) zmalloc(self->count * sizeof(uint64_t));
+
+  self->conflated  = (uint64_t *) zmalloc(self->count * sizeof(uint64_t));
+  self->unrecorded = (uint64_t *) zmalloc(self->count * sizeof(uint64_t));
+
+  // Like zproxy, the frontend and backend bind by default, unless the
+  // endpoints are prefixed with '>'.
+  self->frontend = zsock_new_pull(c->pull);
+
+  if (self->frontend == NULL) {
+    printf("unable to bind PULL endpoint %s\n", c->pull);
+    return -1;
+  }
+
+  self->backend = zsock_new_pub(c->pub);
+
+  if (self->backend == NULL) {
+    printf("unable to bind PUB endpoint %s\n", c->pub);
+    return -1;
+  }
+
+  if (c->snapshot) {
+    self->snapshot = zsock_new_router(c->snapshot);
+
+    if (self->snapshot == NULL) {
+      printf("unable to bind snapshot endpoint %s\n", c->snapshot);
+      return -1;
+    }
+  }
+
+  if (c->record) {
+    recorder_t *recorder = recorder_new(c->record, c->record_segment_size, c->record_segments);
+
+    if (recorder == NULL) {
+      return -1;
+    }
+
+    // The recorder actor takes ownership of the recorder.
+    self->recorder = zactor_new(recorder_actor, recorder);
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    self->shards[i] = shard_new(c, i);
+
+    if (self->shards[i] == NULL) {
+      return -1;
+    }
+  }
+
+  if (self->count == 1) {
+    self->out = self->backend;
+    return 0;
+  }
+
+  // The publisher takes ownership of the backend socket.
+  self->publisher = zactor_new(backend_actor, self->backend);
+  self->backend   = NULL;
+
+  self->out = zsock_new_push(SHARD_BACKEND_ENDPOINT);
+  assert(self->out);
+
+  self->actors = (zactor_t **) zmalloc(self->count * sizeof(zactor_t *));
+  self->routes = (zsock_t **) zmalloc(self->count * sizeof(zsock_t *));
+
+  self->snapshots = zlist_new();
+
+  for (int i = 0; i < self->count; i++) {
+    char endpoint[128];
+
+    shard_endpoint(i, endpoint, sizeof(endpoint));
+
+    self->actors[i] = zactor_new(shard_actor, self->shards[i]);
+    self->routes[i] = zsock_new_push(endpoint);
+
+    assert(self->routes[i]);
+  }
+
+  return 0;
+}
+
+// FNV-1a
+static uint32_t hash(const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *) data;
+  uint32_t h = 2166136261u;
+
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+// Messages for the same topic (or sender) always go to the same shard, so
+// they're published in the order they were received.
+static int route(broker_t *self, zmsg_t *msg) {
+  zframe_t *topic = zmsg_first(msg);
+
+  if (topic == NULL) {
+    return 0;
+  }
+
+  if (self->c->shard_by_sender && zmsg_size(msg) == 2) {
+    zframe_t *payload = zmsg_next(msg);
+    char sender[MAX_SENDER];
+
+    envelope_parse(zframe_data(payload), zframe_size(payload), NULL, NULL, sender, sizeof(sender));
+    return hash(sender, strlen(sender)) % self->count;
+  }
+
+  return hash(zframe_data(topic), zframe_size(topic)) % self->count;
+}
+
+static void handle_frontend(broker_t *self) {
+  zmsg_t *msg = zmsg_recv(self->frontend);
+
+  if (msg == NULL) {
+    return;
+  }
+
+  if (self->count == 1) {
+    shard_process(self->shards[0], &msg, self->backend);
+    return;
+  }
+
+  zmsg_send(&msg, self->routes[route(self, msg)]);
+}
+
+static void send_snapshot(broker_t *self, zmsg_t **reply_p) {
+  zmsg_t *reply = *reply_p;
+
+  if (self->c->verbose) {
+    printf("sent snapshot of %zu envelopes\n", (zmsg_size(reply) - 3) / 2);
+  }
+
+  zmsg_send(reply_p, self->snapshot);
+}
+
+static void finish_snapshot(broker_t *self, pending_snapshot_t *pending) {
+  zlist_remove(self->snapshots, pending);
+
+  send_snapshot(self, &pending->reply);
+  free(pending);
+}
+
+// Handles a shard's reply to a snapshot request, which starts with the
+// request's sequence number.
+static void handle_shard_reply(broker_t *self, zactor_t *actor) {
+  zmsg_t *part = zmsg_recv(actor);
+
+  if (part == NULL) {
+    return;
+  }
+
+  char *seq = zmsg_popstr(part);
+  uint64_t id = seq ? strtoull(seq, NULL, 10) : 0;
+
+  zstr_free(&seq);
+
+  pending_snapshot_t *pending = NULL;
+
+  for (pending_snapshot_t *p = zlist_first(self->snapshots); p != NULL; p = zlist_next(self->snapshots)) {
+    if (p->seq == id) {
+      pending = p;
+      break;
+    }
+  }
+
+  // Late reply to a request that already timed out.
+  if (pending == NULL) {
+    zmsg_destroy(&part);
+    return;
+  }
+
+  for (zframe_t *frame = zmsg_pop(part); frame != NULL; frame = zmsg_pop(part)) {
+    zmsg_append(pending->reply, &frame);
+  }
+
+  zmsg_destroy(&part);
+
+  if (--pending->remaining == 0) {
+    finish_snapshot(self, pending);
+  }
+}
+
+// Replies to snapshot requests that some shards haven't replied to in time
+// with what has been collected so far. Returns the number of milliseconds
+// until the next request times out, or -1 if none are pending.
+static int expire_snapshots(broker_t *self) {
+  if (self->snapshots == NULL) {
+    return -1;
+  }
+
+  int64_t now = zclock_mono();
+
+  // Requests are sent in order with the same timeout, so the oldest request
+  // always times out first.
+  for (pending_snapshot_t *p = zlist_first(self->snapshots); p != NULL; p = zlist_first(self->snapshots)) {
+    if (p->deadline > now) {
+      return (int) (p->deadline - now);
+    }
+
+    if (self->c->verbose) {
+      printf("timed out waiting on %d shards for snapshot\n", p->remaining);
+    }
+
+    finish_snapshot(self, p);
+  }
+
+  return -1;
+}
+
+static void handle_snapshot(broker_t *self) {
+  zmsg_t *req = zmsg_recv(self->snapshot);
+
+  if (req == NULL) {
+    return;
+  }
+
+  zframe_t *identity = zmsg_pop(req);
+  zframe_t *empty    = zmsg_pop(req);
+
+  char *cmd   = zmsg_popstr(req);
+  char *topic = zmsg_popstr(req);
+
+  zmsg_t *reply = zmsg_new();
+
+  zmsg_append(reply, &identity);
+  zmsg_append(reply, &empty);
+
+  if (cmd && streq(cmd, "SNAPSHOT")) {
+    zmsg_addstr(reply, "SNAPSHOT");
+
+    if (self->count == 1) {
+      shard_snapshot(self->shards[0], topic && *topic ? topic : NULL, reply);
+    } else {
+      pending_snapshot_t *pending = (pending_snapshot_t *) zmalloc(sizeof(pending_snapshot_t));
+      assert(pending);
+
+      pending->seq       = ++self->seq;
+      pending->remaining = self->count;
+      pending->deadline  = zclock_mono() + SNAPSHOT_TIMEOUT;
+      pending->reply     = reply;
+
+      char seq[32];
+      snprintf(seq, sizeof(seq), "%" PRIu64, pending->seq);
+
+      for (int i = 0; i < self->count; i++) {
+        zstr_sendx(self->actors[i], "SNAPSHOT", seq, topic ? topic : "", NULL);
+      }
+
+      zlist_append(self->snapshots, pending);
+
+      // Replied to once every shard has replied (see handle_shard_reply).
+      reply = NULL;
+    }
+  } else {
+    zmsg_addstr(reply, "ERROR");
+    zmsg_send(&reply, self->snapshot);
+  }
+
+  if (reply) {
+    send_snapshot(self, &reply);
+  }
+
+  zstr_free(&cmd);
+  zstr_free(&topic);
+  zmsg_destroy(&req);
+}
+
+// Publishes per-shard throughput as a Metric envelope on the HEALTH topic,
+// the same way modules publish their metrics.
+static void report_stats(broker_t *self) {
+  int64_t now = zclock_mono();
+  double elapsed = (now - self->reported) / 1000.0;
+
+  if (elapsed <= 0) {
+    return;
+  }
+
+  char *buf = NULL;
+  size_t size = 0;
+
+  FILE *env = open_memstream(&buf, &size);
+  assert(env);
+
+  fputs("{\"version\":\"v1\",\"kind\":\"Metric\",\"metadata\":{\"sender\":\"message-bus\"},\"contents\":{\"metrics\":[", env);
+
+  for (int i = 0; i < self->count; i++) {
+    uint64_t messages = shard_messages(self->shards[i]);
+    uint64_t bytes    = shard_bytes(self->shards[i]);
+
+    uint64_t conflated  = shard_conflated(self->shards[i]);
+    uint64_t unrecorded = shard_unrecorded(self->shards[i]);
+
+    uint64_t dm = messages - self->messages[i];
+    uint64_t db = bytes - self->bytes[i];
+    uint64_t dc = conflated - self->conflated[i];
+    uint64_t du = unrecorded - self->unrecorded[i];
+
+    self->messages[i]   = messages;
+    self->bytes[i]      = bytes;
+    self->conflated[i]  = conflated;
+    self->unrecorded[i] = unrecorded;
+
+    if (self->c->verbose) {
+      printf("shard %d: %.0f messages/s, %.1f KiB/s, %.0f conflated/s, %.0f unrecorded/s\n", i, dm / elapsed, db / elapsed / 1024, dc / elapsed, du / elapsed);
+    }
+
+    // Counters are sent as deltas since the last report.
+    fprintf(env,
+      "%s{\"kind\":\"Counter\",\"name\":\"message_bus_shard_%d_messages\",\"desc\":\"messages forwarded by shard %d\",\"value\":%" PRIu64 "}"
+      ",{\"kind\":\"Counter\",\"name\":\"message_bus_shard_%d_bytes\",\"desc\":\"bytes forwarded by shard %d\",\"value\":%" PRIu64 "}"
+      ",{\"kind\":\"Counter\",\"name\":\"message_bus_shard_%d_conflated\",\"desc\":\"status messages conflated by shard %d\",\"value\":%" PRIu64 "}"
+      ",{\"kind\":\"Counter\",\"name\":\"message_bus_shard_%d_unrecorded\",\"desc\":\"messages shard %d dropped from the recording\",\"value\":%" PRIu64 "}"
+      ",{\"kind\":\"Gauge\",\"name\":\"message_bus_shard_%d_messages_per_second\",\"desc\":\"messages per second forwarded by shard %d\",\"value\":%.3f}",
+      i == 0 ? "" : ",", i, i, dm, i, i, db, i, i, dc, i, i, du, i, i, dm / elapsed
+    );
+  }
+
+  fputs("]}}", env);
+  fclose(env);
+
+  zmsg_t *msg = zmsg_new();
+
+  zmsg_addstr(msg, "HEALTH");
+  zmsg_addmem(msg, buf, size);
+
+  zmsg_send(&msg, self->out);
+
+  free(buf);
+  self->reported = now;
+}
+
+broker_t *broker_new(config *c) {
+  broker_t *self = (broker_t *) zmalloc(sizeof(broker_t));
+  assert(self);
+
+  self->c = c;
+
+  if (broker_init(self) != 0) {
+    broker_destroy(&self);
+  }
+
+  return self;
+}
+
+void broker_actor(zsock_t *pipe, void *args) {
+  broker_t *self = (broker_t *) args;
+
+  zsock_signal(pipe, 0);
+
+  zpoller_t *poller = zpoller_new(pipe, self->frontend, NULL);
+
+  if (self->snapshot) {
+    zpoller_add(poller, self->snapshot);
+
+    // Shards reply to snapshot requests over their actor pipes.
+    for (int i = 0; self->actors && i < self->count; i++) {
+      zpoller_add(poller, self->actors[i]);
+    }
+  }
+
+  int64_t interval = (int64_t) self->c->stats_interval * 1000;
+  self->reported   = zclock_mono();
+
+  while (1) {
+    int timeout = -1;
+
+    if (interval > 0) {
+      int64_t remaining = self->reported + interval - zclock_mono();
+      timeout = remaining > 0 ? (int) remaining : 0;
+    }
+
+    int expires = expire_snapshots(self);
+
+    if (expires >= 0 && (timeout < 0 || expires < timeout)) {
+      timeout = expires;
+    }
+
+    // Shard threads keep their own ticks.
+    if (self->count == 1) {
+      int tick = shard_tick(self->shards[0], self->backend);
+
+      if (tick >= 0 && (timeout < 0 || tick < timeout)) {
+        timeout = tick;
+      }
+    }
+
+    void *which = zpoller_wait(poller, timeout);
+
+    if (interval > 0 && zclock_mono() - self->reported >= interval) {
+      report_stats(self);
+    }
+
+    if (which == NULL) {
+      if (zpoller_terminated(poller)) {
+        break;
+      }
+
+      continue;
+    }
+
+    if (which == self->frontend) {
+      handle_frontend(self);
+    } else if (which == self->snapshot) {
+      handle_snapshot(self);
+    } else if (which == pipe) {
+      char *cmd = zstr_recv(pipe);
+      int term  = cmd == NULL || streq(cmd, "$TERM");
+
+      zstr_free(&cmd);
+
+      if (term) {
+        break;
+      }
+    } else {
+      handle_shard_reply(self, (zactor_t *) which);
+    }
+  }
+
+  zpoller_destroy(&poller);
+  broker_destroy(&self);
+}
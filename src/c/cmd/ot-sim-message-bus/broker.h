@@ -0,0 +1,65 @@
+#ifndef OTSIM_MESSAGE_BUS_BROKER_H
+#define OTSIM_MESSAGE_BUS_BROKER_H
+
+#include <czmq.h>
+
+typedef struct {
+  int verbose;
+  const char *pull;
+  const char *pub;
+  const char *debug;
+  const char *snapshot;
+
+  int shards;
+  int shard_by_sender;
+  int stats_interval;
+  int io_threads;
+
+  // Milliseconds; zero disables conflation.
+  int conflate;
+
+  // Directory to record to; NULL disables recording.
+  const char *record;
+  size_t record_segment_size;
+  int record_segments;
+} config;
+
+// The broker forwards every message pushed to its PULL endpoint to all
+// subscribers of its PUB endpoint, optionally mirroring each one to the debug
+// endpoint. If a snapshot endpoint is configured, it also keeps a last-value
+// cache of every Status envelope forwarded and serves snapshots of it over a
+// ROUTER socket. Clients send a REQ of "SNAPSHOT" followed by an optional
+// topic frame (all topics if missing or empty) and get back a "SNAPSHOT"
+// frame followed by pairs of topic and Status envelope frames, which can be
+// handled exactly as if they had been received from the PUB endpoint.
+//
+// With more than one shard, messages are routed to shard threads by a hash of
+// their topic (or sender, if shard_by_sender is set), so all the work done
+// per message beyond receiving it is spread across threads while messages
+// for the same topic (or from the same sender) stay in order. Shards forward
+// messages to a single backend thread that owns the PUB socket, so shards are
+// invisible to clients. Every stats_interval seconds, the number of messages
+// and bytes forwarded by each shard is published as metrics on the HEALTH
+// topic.
+//
+// If conflate is set, Status envelopes aren't forwarded as they arrive.
+// Instead, every conflate milliseconds the latest value of each tag updated
+// since the last tick is published, as one Status envelope per topic and
+// sender. This bounds the rate Status envelopes are published at no matter
+// how fast they arrive, so slow subscribers (and the PUB queues for them)
+// can't fall arbitrarily far behind. Everything else, Update commands in
+// particular, is still forwarded as it arrives.
+//
+// If record is set, every message received is also recorded (before any
+// conflation) to the given directory. See recording.h.
+typedef struct _broker_t broker_t;
+
+// Creates a broker, binding (and connecting) all its sockets. Returns NULL if
+// any of them fail. The config must outlive the broker.
+broker_t *broker_new(config *c);
+
+// Runs the broker until it's terminated, then destroys it. Meant to be run
+// with zactor_new, passing the broker as the argument.
+void broker_actor(zsock_t *pipe, void *args);
+
+#endif // OTSIM_MESSAGE_BUS_BROKER_H
@@ -0,0 +1,262 @@
+#include <inttypes.h>
+#include <math.h>
+
+#include "cache.h"
+
+// Tags longer than this are not cached.
+#define MAX_TAG 1024
+
+// Senders longer than this are truncated.
+#define MAX_SENDER 256
+
+typedef struct {
+  double value;
+  uint64_t ts;
+  const char *sender; // interned in cache senders
+  int dirty;
+} entry_t;
+
+struct _cache_t {
+  zhashx_t *topics;  // topic -> zhashx_t of tag -> entry_t
+  zhashx_t *senders; // sender -> interned copy of sender
+  size_t size;
+};
+
+typedef struct {
+  cache_t *cache;
+  zhashx_t *tags;
+  const char *sender;
+  int dirty;
+} update_t;
+
+static void free_item(void **item) {
+  free(*item);
+  *item = NULL;
+}
+
+static void destroy_tags(void **item) {
+  zhashx_destroy((zhashx_t **) item);
+}
+
+static void destroy_chunk(void **item) {
+  zchunk_destroy((zchunk_t **) item);
+}
+
+cache_t *cache_new(void) {
+  cache_t *self = (cache_t *) zmalloc(sizeof(cache_t));
+  assert(self);
+
+  self->topics = zhashx_new();
+  assert(self->topics);
+
+  zhashx_set_destructor(self->topics, destroy_tags);
+
+  self->senders = zhashx_new();
+  assert(self->senders);
+
+  zhashx_set_destructor(self->senders, free_item);
+
+  return self;
+}
+
+void cache_destroy(cache_t **self_p) {
+  assert(self_p);
+
+  if (*self_p) {
+    cache_t *self = *self_p;
+
+    zhashx_destroy(&self->topics);
+    zhashx_destroy(&self->senders);
+
+    free(self);
+    *self_p = NULL;
+  }
+}
+
+static const char *intern(cache_t *self, const char *sender) {
+  char *interned = (char *) zhashx_lookup(self->senders, sender);
+
+  if (interned == NULL) {
+    interned = strdup(sender);
+    zhashx_insert(self->senders, sender, interned);
+  }
+
+  return interned;
+}
+
+// Clears complete if the point can't be cached, or if its value can't be
+// represented in a flushed (JSON encoded) envelope.
+static void check_point(const char *tag, size_t len, double value, uint64_t ts, void *arg) {
+  int *complete = (int *) arg;
+
+  if (len > MAX_TAG || !isfinite(value)) {
+    *complete = 0;
+  }
+}
+
+static void update_point(const char *tag, size_t len, double value, uint64_t ts, void *arg) {
+  update_t *u = (update_t *) arg;
+  char key[MAX_TAG + 1];
+
+  if (len > MAX_TAG) {
+    return;
+  }
+
+  memcpy(key, tag, len);
+  key[len] = '\0';
+
+  entry_t *e = (entry_t *) zhashx_lookup(u->tags, key);
+
+  if (e == NULL) {
+    e = (entry_t *) zmalloc(sizeof(entry_t));
+    zhashx_insert(u->tags, key, e);
+
+    u->cache->size++;
+  }
+
+  e->value  = value;
+  e->ts     = ts;
+  e->sender = u->sender;
+  e->dirty  = u->dirty; // cleared if the envelope is forwarded as is instead
+}
+
+envelope_kind cache_update(cache_t *self, const char *topic, const void *data, size_t size, int *conflated) {
+  char sender[MAX_SENDER];
+  int complete = 1;
+
+  if (conflated != NULL) {
+    *conflated = 0;
+  }
+
+  // Parse once to find the kind and sender, and whether every point can be
+  // conflated, so the topic table is only touched for Status envelopes.
+  envelope_kind kind = envelope_parse(data, size, check_point, &complete, sender, sizeof(sender));
+
+  if (kind != ENVELOPE_STATUS) {
+    return kind;
+  }
+
+  // A truncated sender would stop modules recognizing their own values.
+  if (strlen(sender) >= sizeof(sender) - 1) {
+    complete = 0;
+  }
+
+  zhashx_t *tags = (zhashx_t *) zhashx_lookup(self->topics, topic);
+
+  if (tags == NULL) {
+    tags = zhashx_new();
+    assert(tags);
+
+    zhashx_set_destructor(tags, free_item);
+    zhashx_insert(self->topics, topic, tags);
+  }
+
+  update_t u = {self, tags, intern(self, sender), complete};
+
+  kind = envelope_parse(data, size, update_point, &u, NULL, 0);
+
+  if (conflated != NULL) {
+    *conflated = kind == ENVELOPE_STATUS && complete;
+  }
+
+  return kind;
+}
+
+static void extend(zchunk_t *chunk, const char *str) {
+  zchunk_extend(chunk, str, strlen(str));
+}
+
+// Snapshots are flagged as such in their metadata, as are flushed (conflated)
+// values, so receivers can tell them apart from envelopes sent by modules.
+static zchunk_t *envelope_start(const char *sender, const char *flag) {
+  // Escaping can grow each byte to at most six (\u00XX).
+  char buf[6 * MAX_SENDER + 2];
+  zchunk_t *chunk = zchunk_new(NULL, 4096);
+
+  size_t n = envelope_json_string(buf, sizeof(buf), sender, strlen(sender));
+
+  extend(chunk, "{\"version\":\"v1\",\"kind\":\"Status\",\"metadata\":{\"");
+  extend(chunk, flag);
+  extend(chunk, "\":\"true\",\"sender\":");
+  zchunk_extend(chunk, buf, n);
+  extend(chunk, "},\"contents\":{\"measurements\":[");
+
+  return chunk;
+}
+
+static void snapshot_topic(const char *topic, zhashx_t *tags, zmsg_t *msg, int flush) {
+  zhashx_t *envelopes = zhashx_new();
+  assert(envelopes);
+
+  zhashx_set_destructor(envelopes, destroy_chunk);
+
+  for (entry_t *e = (entry_t *) zhashx_first(tags); e != NULL; e = (entry_t *) zhashx_next(tags)) {
+    const char *tag = (const char *) zhashx_cursor(tags);
+    char buf[6 * MAX_TAG + 128];
+
+    if (flush) {
+      if (!e->dirty) {
+        continue;
+      }
+
+      e->dirty = 0;
+    }
+
+    // Not representable in JSON.
+    if (!isfinite(e->value)) {
+      continue;
+    }
+
+    zchunk_t *chunk = (zchunk_t *) zhashx_lookup(envelopes, e->sender);
+
+    if (chunk == NULL) {
+      chunk = envelope_start(e->sender, flush ? "conflated" : "snapshot");
+      zhashx_insert(envelopes, e->sender, chunk);
+    } else {
+      extend(chunk, ",");
+    }
+
+    size_t n = strlen("{\"tag\":");
+    memcpy(buf, "{\"tag\":", n);
+
+    n += envelope_json_string(buf + n, sizeof(buf) - n, tag, strlen(tag));
+    n += snprintf(buf + n, sizeof(buf) - n, ",\"value\":%.17g,\"ts\":%" PRIu64 "}", e->value, e->ts);
+
+    zchunk_extend(chunk, buf, n);
+  }
+
+  for (zchunk_t *chunk = (zchunk_t *) zhashx_first(envelopes); chunk != NULL; chunk = (zchunk_t *) zhashx_next(envelopes)) {
+    extend(chunk, "]}}");
+
+    zmsg_addstr(msg, topic);
+    zmsg_addmem(msg, zchunk_data(chunk), zchunk_size(chunk));
+  }
+
+  zhashx_destroy(&envelopes);
+}
+
+void cache_snapshot(cache_t *self, const char *topic, zmsg_t *msg) {
+  if (topic != NULL) {
+    zhashx_t *tags = (zhashx_t *) zhashx_lookup(self->topics, topic);
+
+    if (tags != NULL) {
+      snapshot_topic(topic, tags, msg, 0);
+    }
+
+    return;
+  }
+
+  for (zhashx_t *tags = (zhashx_t *) zhashx_first(self->topics); tags != NULL; tags = (zhashx_t *) zhashx_next(self->topics)) {
+    snapshot_topic((const char *) zhashx_cursor(self->topics), tags, msg, 0);
+  }
+}
+
+void cache_flush(cache_t *self, zmsg_t *msg) {
+  for (zhashx_t *tags = (zhashx_t *) zhashx_first(self->topics); tags != NULL; tags = (zhashx_t *) zhashx_next(self->topics)) {
+    snapshot_topic((const char *) zhashx_cursor(self->topics), tags, msg, 1);
+  }
+}
+
+size_t cache_size(cache_t *self) {
+  return self->size;
+}
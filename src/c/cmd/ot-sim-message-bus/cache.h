@@ -0,0 +1,46 @@
+#ifndef OTSIM_MESSAGE_BUS_CACHE_H
+#define OTSIM_MESSAGE_BUS_CACHE_H
+
+#include <czmq.h>
+
+#include "envelope.h"
+
+// The last-value cache keeps the most recent value of every tag published in
+// a Status envelope, per topic, along with the module that published it. It
+// lets modules that start (or restart) after everyone else get the current
+// value of every tag straight away, rather than waiting for each one to next
+// change.
+//
+// Values are also marked dirty when updated, so the same cache can be used to
+// conflate Status envelopes, publishing only the latest value of each tag
+// updated since the last flush. A cache is not thread-safe.
+typedef struct _cache_t cache_t;
+
+cache_t *cache_new(void);
+void cache_destroy(cache_t **self_p);
+
+// Updates the cache with the points in the given message if it's a Status
+// envelope. Returns the kind of the envelope.
+//
+// The points are only marked as dirty if every one of them can be cached and
+// flushed without loss (a tag that's too long, a non-finite value, or a
+// truncated sender would all be lost or changed). If conflated isn't NULL,
+// it's set to whether they were; if not, the caller must forward the original
+// envelope itself, and any of its points still dirty from earlier envelopes
+// are cleared, since they're superseded by the ones being forwarded.
+envelope_kind cache_update(cache_t *self, const char *topic, const void *data, size_t size, int *conflated);
+
+// Appends the cached values for the given topic (or all topics if NULL) to
+// msg as pairs of topic and JSON encoded Status envelope frames. Values are
+// grouped into one envelope per module that published them, so modules can
+// still recognize (and ignore) their own values.
+void cache_snapshot(cache_t *self, const char *topic, zmsg_t *msg);
+
+// Like cache_snapshot, but only includes values that are dirty (updated since
+// the last call), for all topics, and clears them.
+void cache_flush(cache_t *self, zmsg_t *msg);
+
+// Number of tags cached across all topics.
+size_t cache_size(cache_t *self);
+
+#endif // OTSIM_MESSAGE_BUS_CACHE_H
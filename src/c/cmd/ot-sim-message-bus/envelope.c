@@ -0,0 +1,632 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "envelope.h"
+
+// Tags longer than this (once unescaped) are treated as malformed.
+#define MAX_TAG 1024
+
+// Guards against stack exhaustion from deeply nested JSON.
+#define MAX_DEPTH 64
+
+/* BEGIN JSON */
+
+typedef struct {
+  const char *p;
+  const char *end;
+} cursor;
+
+static void ws(cursor *c) {
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')) {
+    c->p++;
+  }
+}
+
+static int consume(cursor *c, char ch) {
+  ws(c);
+
+  if (c->p < c->end && *c->p == ch) {
+    c->p++;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int peek(cursor *c, char ch) {
+  ws(c);
+  return c->p < c->end && *c->p == ch;
+}
+
+// Sets str and len to the raw (still escaped) contents of the string at the
+// cursor, and escaped to whether it contains any escape sequences.
+static int string(cursor *c, const char **str, size_t *len, int *escaped) {
+  if (!consume(c, '"')) {
+    return -1;
+  }
+
+  *str = c->p;
+  *escaped = 0;
+
+  while (c->p < c->end) {
+    if (*c->p == '\\') {
+      *escaped = 1;
+      c->p += 2;
+      continue;
+    }
+
+    if (*c->p == '"') {
+      *len = c->p - *str;
+      c->p++;
+
+      return 0;
+    }
+
+    c->p++;
+  }
+
+  return -1;
+}
+
+static int hex4(const char *s, unsigned int *v) {
+  *v = 0;
+
+  for (int i = 0; i < 4; i++) {
+    char ch = s[i];
+    *v <<= 4;
+
+    if (ch >= '0' && ch <= '9') {
+      *v |= ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+      *v |= ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+      *v |= ch - 'A' + 10;
+    } else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Unescapes the raw string contents into out, returning the unescaped length
+// or -1 if the string is malformed or doesn't fit.
+static long unescape(const char *str, size_t len, char *out, size_t size) {
+  const char *end = str + len;
+  size_t n = 0;
+
+  while (str < end) {
+    unsigned int cp;
+
+    if (*str != '\\') {
+      if (n >= size) {
+        return -1;
+      }
+
+      out[n++] = *str++;
+      continue;
+    }
+
+    if (end - str < 2) {
+      return -1;
+    }
+
+    switch (str[1]) {
+      case '"':  cp = '"';  break;
+      case '\\': cp = '\\'; break;
+      case '/':  cp = '/';  break;
+      case 'b':  cp = '\b'; break;
+      case 'f':  cp = '\f'; break;
+      case 'n':  cp = '\n'; break;
+      case 'r':  cp = '\r'; break;
+      case 't':  cp = '\t'; break;
+      case 'u':
+        if (end - str < 6 || hex4(str + 2, &cp) != 0) {
+          return -1;
+        }
+
+        // Combine surrogate pairs.
+        if (cp >= 0xD800 && cp <= 0xDBFF && end - str >= 12 && str[6] == '\\' && str[7] == 'u') {
+          unsigned int lo;
+
+          if (hex4(str + 8, &lo) == 0 && lo >= 0xDC00 && lo <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            str += 6;
+          }
+        }
+
+        str += 4;
+        break;
+      default:
+        return -1;
+    }
+
+    str += 2;
+
+    if (n + 4 > size) {
+      return -1;
+    }
+
+    if (cp < 0x80) {
+      out[n++] = cp;
+    } else if (cp < 0x800) {
+      out[n++] = 0xC0 | (cp >> 6);
+      out[n++] = 0x80 | (cp & 0x3F);
+    } else if (cp < 0x10000) {
+      out[n++] = 0xE0 | (cp >> 12);
+      out[n++] = 0x80 | ((cp >> 6) & 0x3F);
+      out[n++] = 0x80 | (cp & 0x3F);
+    } else {
+      out[n++] = 0xF0 | (cp >> 18);
+      out[n++] = 0x80 | ((cp >> 12) & 0x3F);
+      out[n++] = 0x80 | ((cp >> 6) & 0x3F);
+      out[n++] = 0x80 | (cp & 0x3F);
+    }
+  }
+
+  return n;
+}
+
+static int key_is(const char *str, size_t len, const char *key) {
+  return strlen(key) == len && memcmp(str, key, len) == 0;
+}
+
+// Input buffers aren't NUL terminated, so numbers are copied out before
+// being handed to strtod and friends.
+static int number(cursor *c, char *buf, size_t size) {
+  ws(c);
+
+  size_t n = 0;
+
+  while (c->p < c->end && strchr("+-0123456789.eE", *c->p) != NULL) {
+    if (n + 1 >= size) {
+      return -1;
+    }
+
+    buf[n++] = *c->p++;
+  }
+
+  buf[n] = '\0';
+  return n > 0 ? 0 : -1;
+}
+
+static int skip(cursor *c, int depth) {
+  const char *str;
+  size_t len;
+  int escaped;
+  char buf[64];
+
+  if (depth > MAX_DEPTH) {
+    return -1;
+  }
+
+  ws(c);
+
+  if (c->p >= c->end) {
+    return -1;
+  }
+
+  switch (*c->p) {
+    case '"':
+      return string(c, &str, &len, &escaped);
+    case '{':
+      c->p++;
+
+      if (consume(c, '}')) {
+        return 0;
+      }
+
+      do {
+        if (string(c, &str, &len, &escaped) != 0 || !consume(c, ':') || skip(c, depth + 1) != 0) {
+          return -1;
+        }
+      } while (consume(c, ','));
+
+      return consume(c, '}') ? 0 : -1;
+    case '[':
+      c->p++;
+
+      if (consume(c, ']')) {
+        return 0;
+      }
+
+      do {
+        if (skip(c, depth + 1) != 0) {
+          return -1;
+        }
+      } while (consume(c, ','));
+
+      return consume(c, ']') ? 0 : -1;
+    case 't':
+    case 'n':
+      if (c->end - c->p < 4) {
+        return -1;
+      }
+
+      c->p += 4;
+      return 0;
+    case 'f':
+      if (c->end - c->p < 5) {
+        return -1;
+      }
+
+      c->p += 5;
+      return 0;
+    default:
+      return number(c, buf, sizeof(buf));
+  }
+}
+
+// Parses an array of points, calling fn for each.
+static int json_points(cursor *c, envelope_point_fn *fn, void *arg) {
+  const char *str;
+  size_t len;
+  int escaped;
+  char num[64];
+  char tag[MAX_TAG];
+
+  if (peek(c, 'n')) { // null
+    return skip(c, 0);
+  }
+
+  if (!consume(c, '[')) {
+    return -1;
+  }
+
+  if (consume(c, ']')) {
+    return 0;
+  }
+
+  do {
+    const char *t = NULL;
+    long tlen = 0;
+    double value = 0;
+    uint64_t ts = 0;
+
+    if (!consume(c, '{')) {
+      return -1;
+    }
+
+    if (!consume(c, '}')) {
+      do {
+        if (string(c, &str, &len, &escaped) != 0 || !consume(c, ':')) {
+          return -1;
+        }
+
+        if (key_is(str, len, "tag")) {
+          if (string(c, &str, &len, &escaped) != 0) {
+            return -1;
+          }
+
+          if (escaped) {
+            if ((tlen = unescape(str, len, tag, sizeof(tag))) < 0) {
+              return -1;
+            }
+
+            t = tag;
+          } else {
+            t = str;
+            tlen = len;
+          }
+        } else if (key_is(str, len, "value")) {
+          if (number(c, num, sizeof(num)) != 0) {
+            return -1;
+          }
+
+          value = strtod(num, NULL);
+        } else if (key_is(str, len, "ts")) {
+          if (number(c, num, sizeof(num)) != 0) {
+            return -1;
+          }
+
+          ts = strtoull(num, NULL, 10);
+        } else if (skip(c, 1) != 0) {
+          return -1;
+        }
+      } while (consume(c, ','));
+
+      if (!consume(c, '}')) {
+        return -1;
+      }
+    }
+
+    if (t != NULL) {
+      fn(t, tlen, value, ts, arg);
+    }
+  } while (consume(c, ','));
+
+  return consume(c, ']') ? 0 : -1;
+}
+
+static envelope_kind json_parse(const char *data, size_t size, envelope_point_fn *fn, void *arg, char *sender, size_t senderSize) {
+  cursor c = {data, data + size};
+  const char *str;
+  size_t len;
+  int escaped;
+
+  envelope_kind kind = ENVELOPE_OTHER;
+  const char *contents = NULL;
+
+  if (!consume(&c, '{')) {
+    return ENVELOPE_INVALID;
+  }
+
+  // Keys can come in any order (the C++ modules sort them, putting contents
+  // first), so find the kind and contents before parsing the contents.
+  if (!consume(&c, '}')) {
+    do {
+      if (string(&c, &str, &len, &escaped) != 0 || !consume(&c, ':')) {
+        return ENVELOPE_INVALID;
+      }
+
+      if (key_is(str, len, "kind")) {
+        if (string(&c, &str, &len, &escaped) != 0) {
+          return ENVELOPE_INVALID;
+        }
+
+        if (key_is(str, len, "Status")) {
+          kind = ENVELOPE_STATUS;
+        } else if (key_is(str, len, "Update")) {
+          kind = ENVELOPE_UPDATE;
+        }
+      } else if (key_is(str, len, "metadata") && sender != NULL && peek(&c, '{')) {
+        c.p++;
+
+        if (!consume(&c, '}')) {
+          do {
+            if (string(&c, &str, &len, &escaped) != 0 || !consume(&c, ':')) {
+              return ENVELOPE_INVALID;
+            }
+
+            if (key_is(str, len, "sender") && peek(&c, '"')) {
+              if (string(&c, &str, &len, &escaped) != 0) {
+                return ENVELOPE_INVALID;
+              }
+
+              long n = escaped ? unescape(str, len, sender, senderSize - 1) : (long) (len < senderSize ? len : senderSize - 1);
+
+              if (n < 0) {
+                n = 0;
+              } else if (!escaped) {
+                memcpy(sender, str, n);
+              }
+
+              sender[n] = '\0';
+            } else if (skip(&c, 1) != 0) {
+              return ENVELOPE_INVALID;
+            }
+          } while (consume(&c, ','));
+
+          if (!consume(&c, '}')) {
+            return ENVELOPE_INVALID;
+          }
+        }
+      } else if (key_is(str, len, "contents")) {
+        ws(&c);
+        contents = c.p;
+
+        if (skip(&c, 1) != 0) {
+          return ENVELOPE_INVALID;
+        }
+      } else if (skip(&c, 1) != 0) {
+        return ENVELOPE_INVALID;
+      }
+    } while (consume(&c, ','));
+
+    if (!consume(&c, '}')) {
+      return ENVELOPE_INVALID;
+    }
+  }
+
+  if (kind == ENVELOPE_OTHER || contents == NULL || fn == NULL) {
+    return kind;
+  }
+
+  const char *field = kind == ENVELOPE_STATUS ? "measurements" : "updates";
+
+  c.p = contents;
+
+  if (!consume(&c, '{')) {
+    return ENVELOPE_INVALID;
+  }
+
+  if (consume(&c, '}')) {
+    return kind;
+  }
+
+  do {
+    if (string(&c, &str, &len, &escaped) != 0 || !consume(&c, ':')) {
+      return ENVELOPE_INVALID;
+    }
+
+    if (key_is(str, len, field)) {
+      if (json_points(&c, fn, arg) != 0) {
+        return ENVELOPE_INVALID;
+      }
+    } else if (skip(&c, 1) != 0) {
+      return ENVELOPE_INVALID;
+    }
+  } while (consume(&c, ','));
+
+  return consume(&c, '}') ? kind : ENVELOPE_INVALID;
+}
+
+/* END JSON */
+
+/* BEGIN BINARY */
+
+// See the Writer class in the C++ msgbus library's codec.cpp for the format.
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+} reader;
+
+static int u16(reader *r, uint16_t *v) {
+  if (r->end - r->p < 2) {
+    return -1;
+  }
+
+  *v = r->p[0] | (r->p[1] << 8);
+  r->p += 2;
+
+  return 0;
+}
+
+static int u32(reader *r, uint32_t *v) {
+  if (r->end - r->p < 4) {
+    return -1;
+  }
+
+  *v = 0;
+
+  for (int i = 0; i < 4; i++) {
+    *v |= (uint32_t) r->p[i] << (i * 8);
+  }
+
+  r->p += 4;
+  return 0;
+}
+
+static int u64(reader *r, uint64_t *v) {
+  if (r->end - r->p < 8) {
+    return -1;
+  }
+
+  *v = 0;
+
+  for (int i = 0; i < 8; i++) {
+    *v |= (uint64_t) r->p[i] << (i * 8);
+  }
+
+  r->p += 8;
+  return 0;
+}
+
+static int bstring(reader *r, const char **str, size_t *len) {
+  uint16_t n;
+
+  if (u16(r, &n) != 0 || r->end - r->p < n) {
+    return -1;
+  }
+
+  *str = (const char *) r->p;
+  *len = n;
+
+  r->p += n;
+  return 0;
+}
+
+static envelope_kind binary_parse(const uint8_t *data, size_t size, envelope_point_fn *fn, void *arg, char *sender, size_t senderSize) {
+  reader r = {data + 1, data + size};
+  const char *str;
+  size_t len;
+  uint32_t count;
+
+  envelope_kind kind = ENVELOPE_OTHER;
+
+  if (bstring(&r, &str, &len) != 0) {
+    return ENVELOPE_INVALID;
+  }
+
+  if (key_is(str, len, "Status")) {
+    kind = ENVELOPE_STATUS;
+  } else if (key_is(str, len, "Update")) {
+    kind = ENVELOPE_UPDATE;
+  }
+
+  if (u32(&r, &count) != 0) {
+    return ENVELOPE_INVALID;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    const char *key;
+    size_t klen;
+
+    if (bstring(&r, &key, &klen) != 0 || bstring(&r, &str, &len) != 0) {
+      return ENVELOPE_INVALID;
+    }
+
+    if (sender != NULL && key_is(key, klen, "sender")) {
+      size_t n = len < senderSize ? len : senderSize - 1;
+
+      memcpy(sender, str, n);
+      sender[n] = '\0';
+    }
+  }
+
+  if (kind == ENVELOPE_OTHER || fn == NULL) {
+    return kind;
+  }
+
+  if (u32(&r, &count) != 0 || count > (size_t) (r.end - r.p) / 18) {
+    return ENVELOPE_INVALID;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t bits, ts;
+    double value;
+
+    if (bstring(&r, &str, &len) != 0 || u64(&r, &bits) != 0 || u64(&r, &ts) != 0) {
+      return ENVELOPE_INVALID;
+    }
+
+    memcpy(&value, &bits, sizeof(value));
+    fn(str, len, value, ts, arg);
+  }
+
+  return kind;
+}
+
+/* END BINARY */
+
+envelope_kind envelope_parse(const void *data, size_t size, envelope_point_fn *fn, void *arg, char *sender, size_t senderSize) {
+  if (sender != NULL && senderSize > 0) {
+    sender[0] = '\0';
+  }
+
+  if (senderSize == 0) {
+    sender = NULL;
+  }
+
+  if (size > 0 && ((const uint8_t *) data)[0] == ENVELOPE_BINARY_VERSION_BYTE) {
+    return binary_parse(data, size, fn, arg, sender, senderSize);
+  }
+
+  return json_parse(data, size, fn, arg, sender, senderSize);
+}
+
+size_t envelope_json_string(char *buf, size_t size, const char *str, size_t len) {
+  size_t n = 0;
+
+#define PUT(ch) do { if (n < size) { buf[n] = (ch); } n++; } while (0)
+
+  PUT('"');
+
+  for (size_t i = 0; i < len; i++) {
+    unsigned char ch = str[i];
+
+    switch (ch) {
+      case '"':  PUT('\\'); PUT('"');  break;
+      case '\\': PUT('\\'); PUT('\\'); break;
+      case '\n': PUT('\\'); PUT('n');  break;
+      case '\r': PUT('\\'); PUT('r');  break;
+      case '\t': PUT('\\'); PUT('t');  break;
+      default:
+        if (ch < 0x20) {
+          static const char *hex = "0123456789abcdef";
+
+          PUT('\\'); PUT('u'); PUT('0'); PUT('0');
+          PUT(hex[ch >> 4]); PUT(hex[ch & 0xF]);
+        } else {
+          PUT(ch);
+        }
+    }
+  }
+
+  PUT('"');
+
+#undef PUT
+
+  return n;
+}
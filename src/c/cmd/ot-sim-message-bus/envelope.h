@@ -0,0 +1,39 @@
+#ifndef OTSIM_MESSAGE_BUS_ENVELOPE_H
+#define OTSIM_MESSAGE_BUS_ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The broker normally forwards envelopes without looking at them. The
+// functions here do just enough parsing of Status and Update envelopes (in
+// either the JSON or binary encoding) to get at their points and sender,
+// without building a document or allocating.
+
+typedef enum {
+  ENVELOPE_INVALID = -1,
+  ENVELOPE_OTHER   = 0,
+  ENVELOPE_STATUS,
+  ENVELOPE_UPDATE,
+} envelope_kind;
+
+// Binary envelopes start with this byte, which can never start a JSON
+// document. Must match BINARY_VERSION_BYTE in the C++ msgbus library.
+#define ENVELOPE_BINARY_VERSION_BYTE 0xB1
+
+// Called for each point in a Status or Update envelope. The tag is not NUL
+// terminated and is only valid for the duration of the call.
+typedef void (envelope_point_fn)(const char *tag, size_t len, double value, uint64_t ts, void *arg);
+
+// Parses the given envelope, calling fn for each of its points if it's a
+// Status or Update envelope. If sender is not NULL, up to size - 1 bytes of
+// the envelope's sender are copied into it (NUL terminated). Returns the kind
+// of the envelope, or ENVELOPE_INVALID if it's malformed (in which case fn may
+// have already been called for some points).
+envelope_kind envelope_parse(const void *data, size_t size, envelope_point_fn *fn, void *arg, char *sender, size_t senderSize);
+
+// Appends the given string to buf as a quoted JSON string, escaping it as
+// needed. Returns the number of bytes written, or the number that would have
+// been written if buf is too small (like snprintf).
+size_t envelope_json_string(char *buf, size_t size, const char *str, size_t len);
+
+#endif // OTSIM_MESSAGE_BUS_ENVELOPE_H
@@ -1,12 +1,7 @@
 #include <czmq.h>
 #include <libxml/parser.h>
 
-typedef struct {
-  int verbose;
-  const char *pull;
-  const char *pub;
-  const char *debug;
-} config;
+#include "broker.h"
 
 #define MATCHXML(e, n) xmlStrcmp(e->name, (const xmlChar*) n) == 0
 
@@ -26,6 +21,24 @@ static int xml_handler(config *c, xmlDoc *doc, xmlNode *node) {
       c->pub = strdup(text);
     } else if (MATCHXML(node, "debug-endpoint")) {
       c->debug = strdup(text);
+    } else if (MATCHXML(node, "snapshot-endpoint")) {
+      c->snapshot = strdup(text);
+    } else if (MATCHXML(node, "shards")) {
+      c->shards = atoi(text);
+    } else if (MATCHXML(node, "shard-by")) {
+      c->shard_by_sender = xmlStrcmp(text, (const xmlChar*) "sender") == 0;
+    } else if (MATCHXML(node, "stats-interval")) {
+      c->stats_interval = atoi(text);
+    } else if (MATCHXML(node, "io-threads")) {
+      c->io_threads = atoi(text);
+    } else if (MATCHXML(node, "conflate")) {
+      c->conflate = atoi(text);
+    } else if (MATCHXML(node, "record")) {
+      c->record = strdup(text);
+    } else if (MATCHXML(node, "record-segment-size")) {
+      c->record_segment_size = strtoull(text, NULL, 10) * 1024 * 1024;
+    } else if (MATCHXML(node, "record-segments")) {
+      c->record_segments = atoi(text);
     }
 
     xmlFree(text);
@@ -78,10 +91,21 @@ static int xml_parse(char *path, config *c) {
 int main(int argc, char *argv[]) {
   config c;
 
-  c.verbose = 0;
-  c.pull    = "tcp://127.0.0.1:1234";
-  c.pub     = "tcp://127.0.0.1:5678";
-  c.debug   = NULL;
+  c.verbose  = 0;
+  c.pull     = "tcp://127.0.0.1:1234";
+  c.pub      = "tcp://127.0.0.1:5678";
+  c.debug    = NULL;
+  c.snapshot = NULL;
+
+  c.shards          = 1;
+  c.shard_by_sender = 0;
+  c.stats_interval  = -1;
+  c.io_threads      = 0;
+  c.conflate        = 0;
+
+  c.record              = NULL;
+  c.record_segment_size = 64 * 1024 * 1024;
+  c.record_segments     = 16;
 
   if (argc == 2) {
     printf("loading config %s\n", argv[1]);
@@ -92,33 +116,55 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  zactor_t *proxy = zactor_new(zproxy, NULL);
-  assert (proxy);
+  printf("using %s for PULL endpoint\n", c.pull);
+  printf("using %s for PUB endpoint\n", c.pub);
+
+  if (c.debug) {
+    printf("mirroring proxied messages to debug endpoint %s\n", c.debug);
+  }
+
+  if (c.snapshot) {
+    printf("serving last-value cache snapshots on %s\n", c.snapshot);
+  }
 
   if (c.verbose) {
     puts("setting proxy to verbose");
+  }
 
-    zstr_sendx(proxy, "VERBOSE", NULL);
-    zsock_wait(proxy);
+  if (c.shards > 1) {
+    printf("sharding messages by %s across %d threads\n", c.shard_by_sender ? "sender" : "topic", c.shards);
   }
 
-  printf("using %s for PULL endpoint\n", c.pull);
+  if (c.conflate > 0) {
+    printf("conflating status messages every %d ms\n", c.conflate);
+  }
 
-  zstr_sendx(proxy, "FRONTEND", "PULL", c.pull, NULL);
-  zsock_wait(proxy);
+  if (c.record) {
+    printf("recording to %s (%d segments of %zu MiB)\n", c.record, c.record_segments, c.record_segment_size / 1024 / 1024);
+  }
 
-  printf("using %s for PUB endpoint\n", c.pub);
+  // Only report stats by default when sharding.
+  if (c.stats_interval < 0) {
+    c.stats_interval = c.shards > 1 ? 5 : 0;
+  }
 
-  zstr_sendx(proxy, "BACKEND", "PUB", c.pub, NULL);
-  zsock_wait(proxy);
+  // ZMQ I/O threads do the actual sending to each subscriber, so more of them
+  // helps when there are lots of subscribers. Must be set before any sockets
+  // are created.
+  if (c.io_threads > 0) {
+    printf("using %d ZMQ I/O threads\n", c.io_threads);
+    zsys_set_io_threads(c.io_threads);
+  }
 
-  if (c.debug) {
-    printf("setting up proxy capture to debug endpoint %s\n", c.debug);
+  broker_t *broker = broker_new(&c);
 
-    zstr_sendx(proxy, "CAPTURE", c.debug, NULL);
-    zsock_wait(proxy);
+  if (broker == NULL) {
+    return 1;
   }
 
+  zactor_t *proxy = zactor_new(broker_actor, broker);
+  assert (proxy);
+
   while(1) {
     puts("proxy running");
 
@@ -0,0 +1,607 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "recording.h"
+
+#define SEGMENT_MAGIC   "OTSIMREC"
+#define SEGMENT_VERSION 1
+#define SEGMENT_SUFFIX  ".rec"
+
+// magic (8), version (4), reserved (4)
+#define SEGMENT_HEADER 16
+
+// "BLK1" when read as a little-endian integer.
+#define BLOCK_MAGIC 0x314B4C42
+
+// magic (4), compressed size (4), raw size (4), message count (4), time of
+// first message (8), time of last message (8)
+#define BLOCK_HEADER 32
+
+// time (8), topic size (2), payload size (4)
+#define RECORD_HEADER 14
+
+// Blocks are compressed once they reach this size (uncompressed)...
+#define BLOCK_SIZE (64 * 1024)
+
+// ...or once they've been pending this long (in milliseconds).
+#define FLUSH_INTERVAL 1000
+
+/* BEGIN ENCODING */
+
+// All integers are little-endian, as in the binary envelope encoding.
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (v >> (i * 8)) & 0xFF;
+  }
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (v >> (i * 8)) & 0xFF;
+  }
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  uint32_t v = 0;
+
+  for (int i = 0; i < 4; i++) {
+    v |= (uint32_t) p[i] << (i * 8);
+  }
+
+  return v;
+}
+
+static uint64_t get64(const uint8_t *p) {
+  uint64_t v = 0;
+
+  for (int i = 0; i < 8; i++) {
+    v |= (uint64_t) p[i] << (i * 8);
+  }
+
+  return v;
+}
+
+/* END ENCODING */
+
+uint64_t recording_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int compare_paths(void *a, void *b) {
+  return strcmp((const char *) a, (const char *) b);
+}
+
+// Returns the full paths of all segments in the given directory, sorted in
+// time order, or NULL if the directory can't be read.
+static zlist_t *list_segments(const char *dir) {
+  DIR *d = opendir(dir);
+
+  if (d == NULL) {
+    return NULL;
+  }
+
+  zlist_t *paths = zlist_new();
+  zlist_autofree(paths);
+
+  struct dirent *entry;
+
+  while ((entry = readdir(d)) != NULL) {
+    size_t len = strlen(entry->d_name);
+
+    // Zero padded times, so they sort as strings.
+    if (len != 20 + strlen(SEGMENT_SUFFIX) || strcmp(entry->d_name + 20, SEGMENT_SUFFIX) != 0) {
+      continue;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+    zlist_append(paths, path);
+  }
+
+  closedir(d);
+
+  zlist_sort(paths, compare_paths);
+  return paths;
+}
+
+static uint64_t segment_start(const char *path) {
+  const char *name = strrchr(path, '/');
+  return strtoull(name ? name + 1 : path, NULL, 10);
+}
+
+/* BEGIN RECORDER */
+
+struct _recorder_t {
+  char *dir;
+  size_t segmentSize;
+  int segments;
+
+  // Paths of all segments kept, oldest first.
+  zlist_t *paths;
+
+  // The current segment.
+  int fd;
+  uint8_t *map;
+  size_t mapSize;
+  size_t used;
+
+  // The pending block, uncompressed.
+  uint8_t *block;
+  size_t blockCap;
+  size_t blockSize;
+  uint32_t count;
+  uint64_t first;
+  uint64_t last;
+  int64_t since;
+
+  uint8_t *scratch;
+  size_t scratchCap;
+};
+
+static void segment_close(recorder_t *self) {
+  if (self->map == NULL) {
+    return;
+  }
+
+  munmap(self->map, self->mapSize);
+
+  // Segments are created at full size up front, so trim off the unused part.
+  if (ftruncate(self->fd, self->used) != 0) {
+    printf("unable to truncate recording segment: %s\n", strerror(errno));
+  }
+
+  close(self->fd);
+
+  self->fd  = -1;
+  self->map = NULL;
+}
+
+static int segment_open(recorder_t *self, uint64_t start, size_t need) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%020" PRIu64 SEGMENT_SUFFIX, self->dir, start);
+
+  size_t size = self->segmentSize;
+
+  if (need + SEGMENT_HEADER > size) {
+    size = need + SEGMENT_HEADER;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    printf("unable to create recording segment %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (ftruncate(fd, size) != 0) {
+    printf("unable to size recording segment %s: %s\n", path, strerror(errno));
+
+    close(fd);
+    unlink(path);
+
+    return -1;
+  }
+
+  uint8_t *map = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED) {
+    printf("unable to map recording segment %s: %s\n", path, strerror(errno));
+
+    close(fd);
+    unlink(path);
+
+    return -1;
+  }
+
+  memcpy(map, SEGMENT_MAGIC, 8);
+  put32(map + 8, SEGMENT_VERSION);
+  put32(map + 12, 0);
+
+  self->fd      = fd;
+  self->map     = map;
+  self->mapSize = size;
+  self->used    = SEGMENT_HEADER;
+
+  zlist_append(self->paths, path);
+
+  while ((int) zlist_size(self->paths) > self->segments) {
+    char *oldest = (char *) zlist_pop(self->paths);
+
+    unlink(oldest);
+    free(oldest);
+  }
+
+  return 0;
+}
+
+recorder_t *recorder_new(const char *dir, size_t segmentSize, int segments) {
+  if (zsys_dir_create("%s", dir) != 0) {
+    printf("unable to create recording directory %s\n", dir);
+    return NULL;
+  }
+
+  zlist_t *paths = list_segments(dir);
+
+  if (paths == NULL) {
+    printf("unable to read recording directory %s\n", dir);
+    return NULL;
+  }
+
+  recorder_t *self = (recorder_t *) zmalloc(sizeof(recorder_t));
+  assert(self);
+
+  self->dir         = strdup(dir);
+  self->segmentSize = segmentSize > SEGMENT_HEADER ? segmentSize : BLOCK_SIZE;
+  self->segments    = segments > 0 ? segments : 1;
+  self->paths       = paths;
+  self->fd          = -1;
+
+  self->blockCap = BLOCK_SIZE;
+  self->block    = (uint8_t *) malloc(self->blockCap);
+
+  self->scratchCap = compressBound(BLOCK_SIZE);
+  self->scratch    = (uint8_t *) malloc(self->scratchCap);
+
+  assert(self->block);
+  assert(self->scratch);
+
+  return self;
+}
+
+void recorder_destroy(recorder_t **self_p) {
+  assert(self_p);
+
+  if (*self_p) {
+    recorder_t *self = *self_p;
+
+    recorder_flush(self);
+    segment_close(self);
+
+    zlist_destroy(&self->paths);
+
+    free(self->dir);
+    free(self->block);
+    free(self->scratch);
+
+    free(self);
+    *self_p = NULL;
+  }
+}
+
+int recorder_flush(recorder_t *self) {
+  if (self->count == 0) {
+    return 0;
+  }
+
+  uLongf size = compressBound(self->blockSize);
+
+  if (size > self->scratchCap) {
+    self->scratch    = (uint8_t *) realloc(self->scratch, size);
+    self->scratchCap = size;
+
+    assert(self->scratch);
+  }
+
+  // Favor speed, since this runs inline with recording.
+  int rc = compress2(self->scratch, &size, self->block, self->blockSize, Z_BEST_SPEED);
+
+  // Start a new block either way, so one bad block doesn't stall recording.
+  uint32_t count = self->count;
+  uint32_t raw   = self->blockSize;
+
+  self->count     = 0;
+  self->blockSize = 0;
+
+  if (rc != Z_OK) {
+    printf("unable to compress recording block: zlib error %d\n", rc);
+    return -1;
+  }
+
+  size_t total = BLOCK_HEADER + size;
+
+  if (self->map == NULL || self->used + total > self->mapSize) {
+    segment_close(self);
+
+    if (segment_open(self, self->first, total) != 0) {
+      return -1;
+    }
+  }
+
+  uint8_t *p = self->map + self->used;
+
+  put32(p, BLOCK_MAGIC);
+  put32(p + 4, size);
+  put32(p + 8, raw);
+  put32(p + 12, count);
+  put64(p + 16, self->first);
+  put64(p + 24, self->last);
+
+  memcpy(p + BLOCK_HEADER, self->scratch, size);
+
+  self->used += total;
+  return 0;
+}
+
+int recorder_write(recorder_t *self, uint64_t ts, const void *topic, size_t topicSize, const void *payload, size_t payloadSize) {
+  if (topicSize > UINT16_MAX || payloadSize > UINT32_MAX - RECORD_HEADER - UINT16_MAX) {
+    return -1;
+  }
+
+  size_t need = RECORD_HEADER + topicSize + payloadSize;
+
+  if (self->count > 0 && self->blockSize + need > BLOCK_SIZE) {
+    recorder_flush(self);
+  }
+
+  // Messages bigger than a block get a block to themselves.
+  if (need > self->blockCap) {
+    self->block    = (uint8_t *) realloc(self->block, need);
+    self->blockCap = need;
+
+    assert(self->block);
+  }
+
+  uint8_t *p = self->block + self->blockSize;
+
+  put64(p, ts);
+  put16(p + 8, topicSize);
+  put32(p + 10, payloadSize);
+
+  memcpy(p + RECORD_HEADER, topic, topicSize);
+  memcpy(p + RECORD_HEADER + topicSize, payload, payloadSize);
+
+  self->blockSize += need;
+
+  if (self->count++ == 0) {
+    self->first = ts;
+    self->since = zclock_mono();
+  }
+
+  self->last = ts;
+
+  if (self->blockSize >= BLOCK_SIZE) {
+    return recorder_flush(self);
+  }
+
+  return 0;
+}
+
+void recorder_actor(zsock_t *pipe, void *args) {
+  recorder_t *self = (recorder_t *) args;
+  zsock_t *in = zsock_new_pull(RECORDER_ENDPOINT);
+
+  assert(in);
+
+  zsock_signal(pipe, 0);
+
+  zpoller_t *poller = zpoller_new(pipe, in, NULL);
+  int failed = 0;
+
+  while (1) {
+    int timeout = -1;
+
+    if (self->count > 0) {
+      int64_t remaining = self->since + FLUSH_INTERVAL - zclock_mono();
+      timeout = remaining > 0 ? (int) remaining : 0;
+    }
+
+    void *which = zpoller_wait(poller, timeout);
+
+    if (which == in) {
+      zmsg_t *msg = zmsg_recv(in);
+
+      // Envelopes are always sent as a topic frame followed by the envelope.
+      if (msg && zmsg_size(msg) == 2) {
+        zframe_t *topic   = zmsg_first(msg);
+        zframe_t *payload = zmsg_next(msg);
+
+        int rc = recorder_write(self, recording_now(), zframe_data(topic), zframe_size(topic), zframe_data(payload), zframe_size(payload));
+
+        // Only report the first of a run of failures.
+        if (rc != 0 && !failed) {
+          printf("failed to record message; recording may be incomplete\n");
+        }
+
+        failed = rc != 0;
+      }
+
+      zmsg_destroy(&msg);
+    } else if (which == pipe) {
+      break; // only ever sent $TERM
+    } else if (which == NULL && zpoller_terminated(poller)) {
+      break;
+    }
+
+    if (self->count > 0 && zclock_mono() - self->since >= FLUSH_INTERVAL) {
+      recorder_flush(self);
+    }
+  }
+
+  zpoller_destroy(&poller);
+  zsock_destroy(&in);
+
+  recorder_destroy(&self);
+}
+
+/* END RECORDER */
+
+/* BEGIN READER */
+
+uint64_t recording_start(const char *dir) {
+  zlist_t *paths = list_segments(dir);
+
+  if (paths == NULL) {
+    return 0;
+  }
+
+  const char *first = (const char *) zlist_first(paths);
+  uint64_t start = first ? segment_start(first) : 0;
+
+  zlist_destroy(&paths);
+  return start;
+}
+
+// Reads the messages in a single segment. Returns 1 if reading should stop
+// (because to was reached), -1 on error or 0 otherwise.
+static int read_segment(const char *path, uint64_t from, uint64_t to, recording_fn *fn, void *arg) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    printf("unable to open recording segment %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < SEGMENT_HEADER) {
+    close(fd);
+    return 0; // empty segment
+  }
+
+  size_t size = st.st_size;
+  uint8_t *map = (uint8_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    printf("unable to map recording segment %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (memcmp(map, SEGMENT_MAGIC, 8) != 0 || get32(map + 8) != SEGMENT_VERSION) {
+    printf("%s is not a recording segment\n", path);
+
+    munmap(map, size);
+    return -1;
+  }
+
+  uint8_t *raw = NULL;
+  size_t rawCap = 0;
+
+  int rc = 0;
+  size_t pos = SEGMENT_HEADER;
+
+  // A segment still being written (or left behind by a crash) is zero filled
+  // past the last block written.
+  while (rc == 0 && pos + BLOCK_HEADER <= size && get32(map + pos) == BLOCK_MAGIC) {
+    const uint8_t *h = map + pos;
+
+    uint32_t csize = get32(h + 4);
+    uint32_t rsize = get32(h + 8);
+    uint64_t first = get64(h + 16);
+    uint64_t last  = get64(h + 24);
+
+    if (pos + BLOCK_HEADER + csize > size) {
+      break; // truncated
+    }
+
+    pos += BLOCK_HEADER + csize;
+
+    if (from && last < from) {
+      continue;
+    }
+
+    if (to && first >= to) {
+      rc = 1;
+      break;
+    }
+
+    if (rsize > rawCap) {
+      raw    = (uint8_t *) realloc(raw, rsize);
+      rawCap = rsize;
+
+      assert(raw);
+    }
+
+    uLongf len = rsize;
+
+    if (uncompress(raw, &len, h + BLOCK_HEADER, csize) != Z_OK || len != rsize) {
+      printf("skipping corrupt block in recording segment %s\n", path);
+      continue;
+    }
+
+    for (size_t r = 0; r + RECORD_HEADER <= len; ) {
+      uint64_t ts       = get64(raw + r);
+      uint16_t tsize    = get16(raw + r + 8);
+      uint32_t psize    = get32(raw + r + 10);
+      const uint8_t *tp = raw + r + RECORD_HEADER;
+
+      if (r + RECORD_HEADER + tsize + psize > len) {
+        break;
+      }
+
+      r += RECORD_HEADER + tsize + psize;
+
+      if (ts < from) {
+        continue;
+      }
+
+      if (to && ts >= to) {
+        rc = 1;
+        break;
+      }
+
+      if (fn(ts, (const char *) tp, tsize, tp + tsize, psize, arg) != 0) {
+        rc = -1;
+        break;
+      }
+    }
+  }
+
+  free(raw);
+  munmap(map, size);
+
+  return rc;
+}
+
+int recording_read(const char *dir, uint64_t from, uint64_t to, recording_fn *fn, void *arg) {
+  zlist_t *paths = list_segments(dir);
+
+  if (paths == NULL) {
+    printf("unable to read recording directory %s\n", dir);
+    return -1;
+  }
+
+  int rc = 0;
+
+  for (char *path = (char *) zlist_first(paths); path != NULL && rc == 0; ) {
+    char *next = (char *) zlist_next(paths);
+
+    // Segments are named for their first message, so a segment can be skipped
+    // entirely if the next one starts before the time wanted.
+    if (!(from && next && segment_start(next) <= from)) {
+      if (to && segment_start(path) >= to) {
+        break;
+      }
+
+      rc = read_segment(path, from, to, fn, arg);
+    }
+
+    path = next;
+  }
+
+  zlist_destroy(&paths);
+  return rc < 0 ? -1 : 0;
+}
+
+/* END READER */
@@ -0,0 +1,63 @@
+#ifndef OTSIM_MESSAGE_BUS_RECORDING_H
+#define OTSIM_MESSAGE_BUS_RECORDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <czmq.h>
+
+// Recordings are directories of segment files, each named for the time (in
+// microseconds since the Unix epoch) of the first message in it, so segments
+// sort in time order. Segments are written through a memory mapping of a
+// fixed (configured) size, and once a segment is full a new one is started.
+// Only the configured number of most recent segments are kept, bounding the
+// size of a recording.
+//
+// A segment is a header followed by blocks of messages compressed with zlib.
+// Each block header records the time of its first and last message, so a
+// reader can find the messages recorded at a given time by skipping whole
+// segments (by name) and then whole blocks (by header) without decompressing
+// them. A block is written once it fills up or has been pending for a second,
+// so at most a second of messages is lost if the broker dies.
+
+// Endpoint the recorder actor receives messages to record on.
+#define RECORDER_ENDPOINT "inproc://ot-sim-message-bus-recorder"
+
+typedef struct _recorder_t recorder_t;
+
+// Creates a recorder writing segments of the given size (in bytes) to the
+// given directory, creating it if needed. Existing segments in the directory
+// count towards the number kept. Returns NULL on error.
+recorder_t *recorder_new(const char *dir, size_t segmentSize, int segments);
+
+// Writes any pending messages and closes the current segment.
+void recorder_destroy(recorder_t **self_p);
+
+// Records a message received at the given time. Returns -1 on error.
+int recorder_write(recorder_t *self, uint64_t ts, const void *topic, size_t topicSize, const void *payload, size_t payloadSize);
+
+// Writes any pending messages to the current segment. Returns -1 on error.
+int recorder_flush(recorder_t *self);
+
+// Runs the recorder, passed as the argument, until terminated, recording
+// every topic and payload message received on RECORDER_ENDPOINT. Destroys
+// the recorder when done.
+void recorder_actor(zsock_t *pipe, void *args);
+
+// Called for each message read from a recording. Returning non-zero stops
+// reading.
+typedef int (recording_fn)(uint64_t ts, const char *topic, size_t topicSize, const void *payload, size_t payloadSize, void *arg);
+
+// Returns the time of the first message in the recording in the given
+// directory, or zero if there isn't one.
+uint64_t recording_start(const char *dir);
+
+// Reads every message recorded at or after from and before to (zero for no
+// limit) in the given directory, in order. Returns -1 on error, including if
+// fn stopped reading.
+int recording_read(const char *dir, uint64_t from, uint64_t to, recording_fn *fn, void *arg);
+
+// Current time in microseconds since the Unix epoch.
+uint64_t recording_now(void);
+
+#endif // OTSIM_MESSAGE_BUS_RECORDING_H
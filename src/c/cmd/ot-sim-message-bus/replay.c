@@ -0,0 +1,157 @@
+#include <czmq.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "recording.h"
+
+typedef struct {
+  zsock_t *push;
+
+  // Zero means as fast as possible.
+  double speed;
+
+  uint64_t first; // time of the first message replayed
+  int64_t start;  // when the first message was replayed (monotonic usecs)
+
+  uint64_t count;
+  uint64_t bytes;
+} replay;
+
+static int replay_message(uint64_t ts, const char *topic, size_t topicSize, const void *payload, size_t payloadSize, void *arg) {
+  replay *r = (replay *) arg;
+
+  if (zsys_interrupted) {
+    return -1;
+  }
+
+  if (r->count == 0) {
+    r->first = ts;
+    r->start = zclock_usecs();
+  } else if (r->speed > 0) {
+    // Keep the same spacing between messages as when they were recorded,
+    // scaled by speed, relative to the first one so errors don't accumulate.
+    int64_t due  = r->start + (int64_t) ((ts - r->first) / r->speed);
+    int64_t wait = due - zclock_usecs();
+
+    if (wait > 0) {
+      usleep(wait);
+    }
+  }
+
+  zmsg_t *msg = zmsg_new();
+
+  zmsg_addmem(msg, topic, topicSize);
+  zmsg_addmem(msg, payload, payloadSize);
+
+  if (zmsg_send(&msg, r->push) != 0) {
+    return -1;
+  }
+
+  r->count++;
+  r->bytes += payloadSize;
+
+  return 0;
+}
+
+static void usage(const char *name) {
+  printf("usage: %s [options] RECORDING-DIR\n\n", name);
+  puts("Replays a message bus recording by pushing it to a message bus.\n");
+  puts("  -e ENDPOINT  PULL endpoint of the message bus to push to (default tcp://127.0.0.1:1234)");
+  puts("  -s SPEED     replay speed as a multiple of real time, or \"max\" (default 1)");
+  puts("  -f SECONDS   start this many seconds into the recording (default 0)");
+  puts("  -t SECONDS   stop this many seconds into the recording (default end)");
+  puts("  -l           loop until interrupted");
+}
+
+int main(int argc, char *argv[]) {
+  const char *endpoint = "tcp://127.0.0.1:1234";
+
+  double speed = 1;
+  double from  = 0;
+  double to    = 0;
+  int loop     = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:s:f:t:lh")) != -1) {
+    switch (opt) {
+      case 'e':
+        endpoint = optarg;
+        break;
+      case 's':
+        speed = streq(optarg, "max") ? 0 : atof(optarg);
+
+        if (speed < 0 || (speed == 0 && !streq(optarg, "max"))) {
+          printf("invalid speed %s\n", optarg);
+          return 1;
+        }
+
+        break;
+      case 'f':
+        from = atof(optarg);
+        break;
+      case 't':
+        to = atof(optarg);
+        break;
+      case 'l':
+        loop = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *dir = argv[optind];
+  uint64_t start  = recording_start(dir);
+
+  if (start == 0) {
+    printf("no recording found in %s\n", dir);
+    return 1;
+  }
+
+  zsock_t *push = zsock_new_push(endpoint);
+
+  if (push == NULL) {
+    printf("unable to connect to %s\n", endpoint);
+    return 1;
+  }
+
+  // Give the connection a chance to come up so the first messages aren't
+  // queued up and then sent in a burst.
+  zclock_sleep(250);
+
+  uint64_t f = start + (uint64_t) (from * 1000000);
+  uint64_t t = to > 0 ? start + (uint64_t) (to * 1000000) : 0;
+
+  printf("replaying %s to %s at %s speed\n", dir, endpoint, speed > 0 ? "scaled" : "max");
+
+  int rc = 0;
+
+  do {
+    replay r = {.push = push, .speed = speed};
+
+    rc = recording_read(dir, f, t, replay_message, &r);
+
+    double elapsed = r.count ? (zclock_usecs() - r.start) / 1e6 : 0;
+
+    printf("replayed %" PRIu64 " messages (%.1f MiB) in %.1f seconds", r.count, r.bytes / 1048576.0, elapsed);
+
+    if (elapsed > 0) {
+      printf(" (%.0f messages/s)", r.count / elapsed);
+    }
+
+    puts("");
+  } while (loop && rc == 0 && !zsys_interrupted);
+
+  // Let queued messages go out before exiting.
+  zsock_set_linger(push, 5000);
+  zsock_destroy(&push);
+
+  return rc == 0 || zsys_interrupted ? 0 : 1;
+}
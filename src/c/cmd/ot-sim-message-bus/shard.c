@@ -0,0 +1,287 @@
+#include <stdatomic.h>
+
+#include "cache.h"
+#include "recording.h"
+#include "shard.h"
+
+// Topics longer than this aren't cached.
+#define MAX_TOPIC 256
+
+struct _shard_t {
+  config *c;
+  int id;
+
+  zsock_t *capture;
+  zsock_t *record;
+  cache_t *cache;
+
+  // Only set when conflating.
+  int64_t next;
+
+  atomic_uint_fast64_t messages;
+  atomic_uint_fast64_t bytes;
+  atomic_uint_fast64_t conflated;
+  atomic_uint_fast64_t unrecorded;
+};
+
+shard_t *shard_new(config *c, int id) {
+  shard_t *self = (shard_t *) zmalloc(sizeof(shard_t));
+  assert(self);
+
+  self->c  = c;
+  self->id = id;
+
+  // Like zproxy, the capture socket connects unless the endpoint is prefixed
+  // with '@'.
+  if (c->debug) {
+    self->capture = zsock_new_push(c->debug);
+
+    if (self->capture == NULL) {
+      printf("unable to connect to debug endpoint %s\n", c->debug);
+
+      shard_destroy(&self);
+      return NULL;
+    }
+  }
+
+  if (c->record) {
+    self->record = zsock_new_push(RECORDER_ENDPOINT);
+    assert(self->record);
+
+    // Never wait on the recorder; if it falls behind, messages go unrecorded
+    // rather than stalling forwarding.
+    zsock_set_sndtimeo(self->record, 0);
+  }
+
+  if (c->snapshot || c->conflate > 0) {
+    self->cache = cache_new();
+  }
+
+  if (c->conflate > 0) {
+    self->next = zclock_mono() + c->conflate;
+  }
+
+  atomic_init(&self->messages, 0);
+  atomic_init(&self->bytes, 0);
+  atomic_init(&self->conflated, 0);
+  atomic_init(&self->unrecorded, 0);
+
+  return self;
+}
+
+void shard_destroy(shard_t **self_p) {
+  assert(self_p);
+
+  if (*self_p) {
+    shard_t *self = *self_p;
+
+    zsock_destroy(&self->capture);
+    zsock_destroy(&self->record);
+    cache_destroy(&self->cache);
+
+    free(self);
+    *self_p = NULL;
+  }
+}
+
+// Sends a copy of the message to the debug endpoint and recorder, if enabled.
+static void mirror(shard_t *self, zmsg_t *msg) {
+  if (self->capture) {
+    zmsg_t *copy = zmsg_dup(msg);
+    zmsg_send(&copy, self->capture);
+  }
+
+  if (self->record) {
+    zmsg_t *copy = zmsg_dup(msg);
+
+    if (zmsg_send(&copy, self->record) != 0) {
+      atomic_fetch_add_explicit(&self->unrecorded, 1, memory_order_relaxed);
+      zmsg_destroy(&copy);
+    }
+  }
+}
+
+void shard_process(shard_t *self, zmsg_t **msg_p, zsock_t *out) {
+  zmsg_t *msg = *msg_p;
+
+  if (self->c->verbose) {
+    zmsg_print(msg);
+  }
+
+  atomic_fetch_add_explicit(&self->messages, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&self->bytes, zmsg_content_size(msg), memory_order_relaxed);
+
+  // Envelopes are always sent as a topic frame followed by the envelope.
+  if (self->cache && zmsg_size(msg) == 2) {
+    zframe_t *topic   = zmsg_first(msg);
+    zframe_t *payload = zmsg_next(msg);
+
+    if (zframe_size(topic) < MAX_TOPIC) {
+      char t[MAX_TOPIC];
+
+      memcpy(t, zframe_data(topic), zframe_size(topic));
+      t[zframe_size(topic)] = '\0';
+
+      // Malformed envelopes are still forwarded as is, so the modules
+      // they're meant for can decide what to do with them.
+      int conflated = 0;
+      envelope_kind kind = cache_update(self->cache, t, zframe_data(payload), zframe_size(payload), &conflated);
+
+      if (kind == ENVELOPE_INVALID && self->c->verbose) {
+        printf("not caching malformed envelope on topic %s\n", t);
+      }
+
+      // Only the latest value of each tag matters for Status envelopes, so
+      // when conflating they're published on the next tick. Anything else
+      // (Update commands in particular) is never conflated, nor are Status
+      // envelopes the cache can't reproduce exactly on a flush.
+      if (kind == ENVELOPE_STATUS && !conflated && self->c->conflate > 0 && self->c->verbose) {
+        printf("not conflating lossy envelope on topic %s\n", t);
+      }
+
+      if (conflated && self->c->conflate > 0) {
+        atomic_fetch_add_explicit(&self->conflated, 1, memory_order_relaxed);
+
+        // Still capture and record the original envelope.
+        mirror(self, msg);
+        zmsg_destroy(msg_p);
+
+        return;
+      }
+    }
+  }
+
+  mirror(self, msg);
+  zmsg_send(msg_p, out);
+}
+
+int shard_tick(shard_t *self, zsock_t *out) {
+  if (self->c->conflate <= 0) {
+    return -1;
+  }
+
+  int64_t now = zclock_mono();
+
+  if (now < self->next) {
+    return (int) (self->next - now);
+  }
+
+  zmsg_t *pairs = zmsg_new();
+  cache_flush(self->cache, pairs);
+
+  for (zframe_t *topic = zmsg_pop(pairs); topic != NULL; topic = zmsg_pop(pairs)) {
+    zframe_t *payload = zmsg_pop(pairs);
+    zmsg_t *msg = zmsg_new();
+
+    zmsg_append(msg, &topic);
+    zmsg_append(msg, &payload);
+
+    zmsg_send(&msg, out);
+  }
+
+  zmsg_destroy(&pairs);
+
+  // Skip any ticks missed entirely rather than flushing repeatedly to catch up.
+  self->next += self->c->conflate;
+
+  if (self->next <= now) {
+    self->next = now + self->c->conflate;
+  }
+
+  return (int) (self->next - now);
+}
+
+void shard_snapshot(shard_t *self, const char *topic, zmsg_t *msg) {
+  if (self->cache) {
+    cache_snapshot(self->cache, topic, msg);
+  }
+}
+
+uint64_t shard_messages(shard_t *self) {
+  return atomic_load_explicit(&self->messages, memory_order_relaxed);
+}
+
+uint64_t shard_bytes(shard_t *self) {
+  return atomic_load_explicit(&self->bytes, memory_order_relaxed);
+}
+
+uint64_t shard_conflated(shard_t *self) {
+  return atomic_load_explicit(&self->conflated, memory_order_relaxed);
+}
+
+uint64_t shard_unrecorded(shard_t *self) {
+  return atomic_load_explicit(&self->unrecorded, memory_order_relaxed);
+}
+
+void shard_endpoint(int id, char *buf, size_t size) {
+  snprintf(buf, size, "inproc://ot-sim-message-bus-shard-%d", id);
+}
+
+static void handle_pipe(shard_t *self, zsock_t *pipe, int *term) {
+  zmsg_t *msg = zmsg_recv(pipe);
+
+  if (msg == NULL) {
+    *term = 1;
+    return;
+  }
+
+  char *cmd = zmsg_popstr(msg);
+
+  if (cmd == NULL || streq(cmd, "$TERM")) {
+    *term = 1;
+  } else if (streq(cmd, "SNAPSHOT")) {
+    char *seq    = zmsg_popstr(msg);
+    char *topic  = zmsg_popstr(msg);
+    zmsg_t *reply = zmsg_new();
+
+    zmsg_addstr(reply, seq ? seq : "");
+
+    shard_snapshot(self, topic && *topic ? topic : NULL, reply);
+    zmsg_send(&reply, pipe);
+
+    zstr_free(&seq);
+    zstr_free(&topic);
+  }
+
+  zstr_free(&cmd);
+  zmsg_destroy(&msg);
+}
+
+void shard_actor(zsock_t *pipe, void *args) {
+  shard_t *self = (shard_t *) args;
+  char endpoint[128];
+
+  shard_endpoint(self->id, endpoint, sizeof(endpoint));
+
+  zsock_t *in  = zsock_new_pull(endpoint);
+  zsock_t *out = zsock_new_push(SHARD_BACKEND_ENDPOINT);
+
+  assert(in);
+  assert(out);
+
+  zsock_signal(pipe, 0);
+
+  zpoller_t *poller = zpoller_new(pipe, in, NULL);
+  int term = 0;
+
+  while (!term) {
+    void *which = zpoller_wait(poller, shard_tick(self, out));
+
+    if (which == in) {
+      zmsg_t *msg = zmsg_recv(in);
+
+      if (msg) {
+        shard_process(self, &msg, out);
+      }
+    } else if (which == pipe) {
+      handle_pipe(self, pipe, &term);
+    } else if (zpoller_terminated(poller)) {
+      break;
+    }
+  }
+
+  zpoller_destroy(&poller);
+
+  zsock_destroy(&in);
+  zsock_destroy(&out);
+}
@@ -0,0 +1,64 @@
+#ifndef OTSIM_MESSAGE_BUS_SHARD_H
+#define OTSIM_MESSAGE_BUS_SHARD_H
+
+#include <stdint.h>
+
+#include <czmq.h>
+
+#include "broker.h"
+
+// A shard does all the per-message work the broker does beyond forwarding
+// (caching, capturing, counting) for the subset of messages routed to it.
+// With a single shard the broker calls into it directly. With more, each one
+// runs in its own thread (see shard_actor), receiving messages from the
+// broker over inproc and sending them on to the backend thread to be
+// published.
+typedef struct _shard_t shard_t;
+
+// Creates a shard, connecting its capture and recorder sockets (if
+// configured). Returns NULL if that fails.
+shard_t *shard_new(config *c, int id);
+void shard_destroy(shard_t **self_p);
+
+// Processes the given message and sends it on to out, taking ownership of it.
+// If conflating, Status envelopes are held back until the next tick instead.
+void shard_process(shard_t *self, zmsg_t **msg_p, zsock_t *out);
+
+// If conflating and the current tick has ended, sends the latest value of
+// every tag updated during it to out, as one Status envelope per topic and
+// sender. Returns the number of milliseconds until the next tick, or -1 if not
+// conflating.
+int shard_tick(shard_t *self, zsock_t *out);
+
+// Appends the shard's cached values for the given topic (or all topics if
+// NULL) to msg. See cache_snapshot.
+void shard_snapshot(shard_t *self, const char *topic, zmsg_t *msg);
+
+// Messages and bytes processed by the shard so far. Safe to call from any
+// thread.
+uint64_t shard_messages(shard_t *self);
+uint64_t shard_bytes(shard_t *self);
+
+// Status envelopes conflated by the shard so far (and thus not forwarded as
+// is). Safe to call from any thread.
+uint64_t shard_conflated(shard_t *self);
+
+// Messages the shard didn't record because the recorder had fallen behind.
+// Safe to call from any thread.
+uint64_t shard_unrecorded(shard_t *self);
+
+// Endpoint the shard's actor receives messages on.
+void shard_endpoint(int id, char *buf, size_t size);
+
+// Endpoint the backend thread receives messages to publish on.
+#define SHARD_BACKEND_ENDPOINT "inproc://ot-sim-message-bus-backend"
+
+// Runs the shard, passed as the argument, until terminated. Messages are
+// received on its shard_endpoint and sent to SHARD_BACKEND_ENDPOINT, which
+// must already be bound. Snapshots are requested over the actor pipe by
+// sending "SNAPSHOT", a request sequence number and a topic (empty for all
+// topics), and are replied to with a single message of the sequence number
+// followed by topic and envelope frame pairs. Does not destroy the shard.
+void shard_actor(zsock_t *pipe, void *args);
+
+#endif // OTSIM_MESSAGE_BUS_SHARD_H
@@ -5,6 +5,7 @@ import (
 	"fmt"
 	"net/http"
 	"regexp"
+	"sync"
 
 	"github.com/patsec/ot-sim/msgbus"
 
@@ -14,12 +15,70 @@ import (
 )
 
 var (
-	counters = make(map[string]prometheus.Counter)
-	gauges   = make(map[string]prometheus.Gauge)
+	counters  = make(map[string]prometheus.Counter)
+	gauges    = make(map[string]prometheus.Gauge)
+	snapshots = &snapshotCollector{metrics: make(map[string]snapshot)}
 
 	nameRegex = regexp.MustCompile(`-|:|\.`)
 )
 
+type snapshot struct {
+	desc   *prometheus.Desc
+	metric msgbus.Metric
+}
+
+// snapshotCollector exports the latest histogram and summary snapshots
+// received for each metric. They're already aggregated by the sender, so they
+// are exported as constant metrics rather than being observed again.
+type snapshotCollector struct {
+	sync.Mutex
+
+	metrics map[string]snapshot
+}
+
+func (this *snapshotCollector) update(metric msgbus.Metric) {
+	this.Lock()
+	defer this.Unlock()
+
+	snap, ok := this.metrics[metric.Name]
+	if !ok {
+		snap.desc = prometheus.NewDesc(nameRegex.ReplaceAllString(metric.Name, "_"), metric.Desc, nil, nil)
+	}
+
+	snap.metric = metric
+	this.metrics[metric.Name] = snap
+}
+
+// Describe sends no descriptors, making this an unchecked collector since the
+// metrics it exports aren't known until they're received.
+func (this *snapshotCollector) Describe(chan<- *prometheus.Desc) {}
+
+func (this *snapshotCollector) Collect(ch chan<- prometheus.Metric) {
+	this.Lock()
+	defer this.Unlock()
+
+	for _, snap := range this.metrics {
+		switch snap.metric.Kind {
+		case msgbus.METRIC_HISTOGRAM:
+			buckets := make(map[float64]uint64)
+
+			for _, bucket := range snap.metric.Buckets {
+				buckets[bucket.Upper] = bucket.Count
+			}
+
+			ch <- prometheus.MustNewConstHistogram(snap.desc, snap.metric.Count, snap.metric.Sum, buckets)
+		case msgbus.METRIC_SUMMARY:
+			quantiles := make(map[float64]float64)
+
+			for _, quantile := range snap.metric.Quantiles {
+				quantiles[quantile.Quantile] = quantile.Value
+			}
+
+			ch <- prometheus.MustNewConstSummary(snap.desc, snap.metric.Count, snap.metric.Sum, quantiles)
+		}
+	}
+}
+
 func metricsHandler(topic, msg string) error {
 	env, err := msgbus.ParseEnvelope([]byte(msg))
 	if err != nil {
@@ -61,6 +120,8 @@ func metricsHandler(topic, msg string) error {
 			}
 
 			gauge.Set(metric.Value)
+		case msgbus.METRIC_HISTOGRAM, msgbus.METRIC_SUMMARY:
+			snapshots.update(metric)
 		}
 	}
 
@@ -68,6 +129,8 @@ func metricsHandler(topic, msg string) error {
 }
 
 func init() {
+	prometheus.MustRegister(snapshots)
+
 	mux := http.NewServeMux()
 	mux.Handle("/metrics", promhttp.Handler())
 
@@ -15,8 +15,10 @@ type (
 const (
 	ENVELOPE_METRIC EnvelopeKind = "Metric"
 
-	METRIC_COUNTER MetricKind = "Counter"
-	METRIC_GAUGE   MetricKind = "Gauge"
+	METRIC_COUNTER   MetricKind = "Counter"
+	METRIC_GAUGE     MetricKind = "Gauge"
+	METRIC_HISTOGRAM MetricKind = "Histogram"
+	METRIC_SUMMARY   MetricKind = "Summary"
 )
 
 var (
@@ -119,6 +121,24 @@ type Metric struct {
 	Name  string     `json:"name"`
 	Desc  string     `json:"desc"`
 	Value float64    `json:"value"`
+
+	// Only used by histogram and summary metrics.
+	Count     uint64            `json:"count,omitempty"`
+	Sum       float64           `json:"sum,omitempty"`
+	Buckets   []HistogramBucket `json:"buckets,omitempty"`
+	Quantiles []SummaryQuantile `json:"quantiles,omitempty"`
+}
+
+// HistogramBucket holds the number of observations less than or equal to
+// Upper (cumulative).
+type HistogramBucket struct {
+	Upper float64 `json:"upper"`
+	Count uint64  `json:"count"`
+}
+
+type SummaryQuantile struct {
+	Quantile float64 `json:"quantile"`
+	Value    float64 `json:"value"`
 }
 
 type Metrics struct {